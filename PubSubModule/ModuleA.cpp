@@ -4,25 +4,25 @@
 #include <iostream>
 using namespace std;
 
-static void delay(unsigned int milliseconds) {
-    boost::this_thread::sleep_for(boost::chrono::milliseconds(milliseconds));
-}
-
 static double get_fake_sensor_data() {
     static double i = 1.00;
     i *= 1.50;
     return i;
 }
 
-void Module_A::task() {
-    ITPS::Publisher<double> pub("sensorA data");
+void Module_A::task(StopToken stop) {
+    ITPS::Tracer::set_thread_name("Module_A");
+    // late subscribers get seeded with the whole history, no startup delay needed
+    ITPS::Publisher<double> pub("sensorA data", 100);
 
-    delay(1000);
+    // diagnostics nobody subscribes to in this demo: the report is never even built
+    ITPS::Publisher<std::string> diagnostics("sensorA diagnostics");
 
     double data;
-    for(int i = 0; i < 100; i++) {
+    for(int i = 0; i < 100 && !stop.stop_requested(); i++) {
         // data = get_fake_sensor_data();
         pub.publish(double(i));
+        diagnostics.publish_lazy([i]() { return "sample " + std::to_string(i) + " published"; });
     }
 
 
@@ -6,5 +6,5 @@
 class Module_A : public Module {
     public:
         Module_A() : Module() {} 
-        void task();
+        void task(StopToken stop);
 };
\ No newline at end of file
@@ -2,23 +2,19 @@
 #include <iostream>
 using namespace std;
 
-static void delay(unsigned int milliseconds) {
-    boost::this_thread::sleep_for(boost::chrono::milliseconds(milliseconds));
-}
-
 static double get_fake_sensor_data() {
     static double i = 1.00;
     i /= 2.00;
     return i;
 }
 
-void Module_B::task() {
-    ITPS::Publisher<double> pub("sensorB data");
-
-    delay(1000);
+void Module_B::task(StopToken stop) {
+    ITPS::Tracer::set_thread_name("Module_B");
+    // late subscribers get seeded with the whole history, no startup delay needed
+    ITPS::Publisher<double> pub("sensorB data", 50);
 
     double data;
-    for(int i = 0; i < 50; i++) {
+    for(int i = 0; i < 50 && !stop.stop_requested(); i++) {
         // data = get_fake_sensor_data();
         pub.publish(double(i));
     }
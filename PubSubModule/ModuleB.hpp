@@ -4,5 +4,5 @@
 
 
 class Module_B : public Module {
-    public: void task(); 
+    public: void task(StopToken stop); 
 };
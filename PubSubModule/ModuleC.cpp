@@ -4,19 +4,43 @@
 using namespace std;
 
 
-void Module_C::task() {
+void Module_C::task(StopToken stop) {
+    ITPS::Tracer::set_thread_name("Module_C");
     ITPS::Subscriber<double> subA("sensorA data", 100); // set buffer queue size to 100 
     ITPS::Subscriber<double> subB("sensorB data", 100);
 
     while(!subA.subscribe());
     while(!subB.subscribe());
 
-    for(int i = 0; i < 100; i++) {
+    // rolling statistics over the last 20 samples of A, the queue holds all 100 until update()
+    ITPS::WindowedSubscriber<double> windowA("sensorA data", 20, 0, 100);
+    while(!windowA.subscribe());
+
+    // fuse A & B samples carrying the same stamp (here the sample value itself)
+    auto stamp = [](const double& data) { return data; };
+    ITPS::Synchronizer<double, double> sync(ITPS::SyncPolicy::ExactTime, 0, 100, stamp, stamp);
+    sync.set_callback([](const std::tuple<double, double>& set) {
         cout << "<================>" << endl;
-        cout << "A: " << subA.pop_msg() << endl;
-        cout << "B: " << subB.pop_msg(100, -1) << endl; // pop with timeout of 100 milliseconds, default return is -1 on timed out
-        // pubB only sends 50 data, so half of the output for B should be timed out -1
+        cout << "A: " << std::get<0>(set) << endl;
+        cout << "B: " << std::get<1>(set) << endl;
+    });
+
+    for(int i = 0; i < 100 && !stop.stop_requested(); i++) {
+        sync.add<0>(subA.pop_msg());
+        double b = subB.pop_msg(100, -1); // pop with timeout of 100 milliseconds, default return is -1 on timed out
+        if(b != -1) {
+            sync.add<1>(b);
+        }
+        // pubB only sends 50 data, so only 50 sets get matched
     }
 
+    windowA.update();
+    ITPS::WindowStats statsA = windowA.stats();
+    cout << "A window: mean " << statsA.mean << ", min " << statsA.min << ", max " << statsA.max
+         << ", p90 " << windowA.percentile(0.9) << endl;
 
-}
\ No newline at end of file
+    ITPS::SyncStats stats = sync.stats();
+    cout << "matched: " << stats.matched 
+         << ", unmatched A: " << stats.dropped[0] + stats.pending[0]
+         << ", unmatched B: " << stats.dropped[1] + stats.pending[1] << endl;
+}
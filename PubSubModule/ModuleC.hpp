@@ -5,5 +5,5 @@
 
 
 class Module_C : public Module {
-    public: void task(); 
+    public: void task(StopToken stop); 
 };
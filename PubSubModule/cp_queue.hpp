@@ -4,40 +4,218 @@
  */
 
 #include <boost/thread/thread.hpp>
-#include <queue>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <atomic>
 #include <boost/chrono.hpp>
 #include <boost/chrono/system_clocks.hpp>
 
+#include "virtual_clock.hpp"
+
+/* Hot fields touched by different threads are aligned to this so they don't share a cache line */
+#ifndef ITPS_CACHE_LINE
+#define ITPS_CACHE_LINE 64
+#endif
+
+/* What produce() does when the queue is full */
+enum class OverflowPolicy {
+    Block,      // wait until a consumer makes room (default)
+    DropNewest, // discard the datum being produced
+    DropOldest, // evict the oldest queued datum to make room
+    Expand      // double the capacity of the ring (allocates)
+};
+
+/* Process-wide budget for the slots of every ConsumerProducerQueue, in bytes 
+ * (capacity * (sizeof(data_t) + 8 bytes of tag), data owning heap memory e.g. std::string only count their handle).
+ * Fixed-size queues are always charged, elastic queues only grow while the budget allows it.
+ * A limit of 0 (default) means unlimited.
+ */
+class QueueBudget {
+    public:
+        static void set_limit(size_t bytes) {
+            limit_bytes() = bytes;
+        }
+
+        static size_t limit() {
+            return limit_bytes();
+        }
+
+        static size_t used() {
+            return used_bytes();
+        }
+
+        // charge bytes if it fits in the budget
+        static bool try_charge(size_t bytes) {
+            size_t used = used_bytes();
+            do {
+                size_t limit = limit_bytes();
+                if(limit != 0 && used + bytes > limit) {
+                    return false;
+                }
+            } while(!used_bytes().compare_exchange_weak(used, used + bytes));
+            return true;
+        }
+
+        // charge bytes regardless of the limit
+        static void charge(size_t bytes) {
+            used_bytes() += bytes;
+        }
+
+        static void release(size_t bytes) {
+            used_bytes() -= bytes;
+        }
+
+    private:
+        static std::atomic<size_t>& used_bytes() {
+            static std::atomic<size_t> used{0};
+            return used;
+        }
+
+        static std::atomic<size_t>& limit_bytes() {
+            static std::atomic<size_t> limit{0};
+            return limit;
+        }
+};
+
+/* The queue is a ring of max_size slots allocated once in the constructor, produce() and
+ * consume() move data in and out of the slots without touching the heap.
+ * (data_t must be default constructible)
+ *
+ * Elastic queues start with initial_size slots and grow by chunk_size slots when full, up to
+ * max_size slots and as long as QueueBudget allows it. Once they can't grow, the overflow
+ * policy applies. After sustained low occupancy (a quarter full or less for a whole ring's
+ * worth of consumes in a row) they shrink by a chunk, down to initial_size. Resizing moves
+ * the data into a new ring, it's the only time an elastic queue allocates.
+ *
+ * A datum can carry a tag (e.g. the msg seq for ITPS::Tracer), kept in a side ring allocated
+ * with the queue, so that tagging never allocates on the produce path. Untagged data read
+ * back as tag 0.
+ *
+ * With a time-to-live (set_ttl()), data older than the TTL (ITPS::Clock time since their
+ * produce()) are discarded instead of being consumed, and make room for a producer finding the
+ * queue full. A producer blocked on a full queue waits at most until its oldest datum expires.
+ * Expired data count as dropped().
+ *
+ * Every field is read & written under the single lock, so they're kept together: splitting
+ * head & tail onto separate cache lines wouldn't keep producers & consumers apart.
+ */
 template <typename data_t> 
 class ConsumerProducerQueue {
     public:
-        ConsumerProducerQueue(unsigned int max_size) {
+        typedef unsigned long long tag_t;
+
+        ConsumerProducerQueue(unsigned int max_size) : ring(max_size), tags(max_size) {
             this->max_size = max_size;
+            this->min_size = this->max_cap = max_size;
+            QueueBudget::charge(slot_bytes(max_size));
+        }
+
+        // elastic queue
+        ConsumerProducerQueue(unsigned int initial_size, unsigned int max_size, unsigned int chunk_size) 
+            : ConsumerProducerQueue(initial_size) {
+            this->max_cap = std::max(max_size, initial_size);
+            this->chunk_size = std::max(chunk_size, 1u);
+        }
+
+        ConsumerProducerQueue(const ConsumerProducerQueue&) = delete;
+        ConsumerProducerQueue& operator=(const ConsumerProducerQueue&) = delete;
+
+        ~ConsumerProducerQueue() {
+            QueueBudget::release(slot_bytes(max_size));
         }
 
-        void produce(data_t data) {
+        /* return true if it had to wait for room in a full queue */
+        bool produce(data_t data, tag_t tag = 0) {
+            bool waited = false;
             mu.lock();
-            while(is_full()) {
-                 // freeze this thread until queue is not full
-                cond_not_full.wait(mu);
+            if(is_full()) {
+                drop_expired();
             }
-            cp_queue.push(data);
+            if(is_full() && !closed) {
+                try_grow();
+            }
+            if(is_full() && !closed && policy == OverflowPolicy::Block) {
+                // record the stall, for ITPS::StallWatchdog
+                if(blocked_producers++ == 0) {
+                    blocked_since = boost::chrono::steady_clock::now();
+                    num_stalls++;
+                }
+                while(is_full() && !closed && policy == OverflowPolicy::Block) {
+                    // freeze this thread until queue is not full (or until the oldest datum expires)
+                    if(ttl == ttl.zero()) {
+                        cond_not_full.wait(mu);
+                    }
+                    else {
+                        cond_not_full.wait_until(mu, stamps[head] + ttl);
+                        drop_expired();
+                    }
+                }
+                waited = true;
+                blocked_producers--;
+            }
+            if(closed) {
+                // nobody consumes a closed queue anymore, drop the datum
+                mu.unlock();
+                return waited;
+            }
+            if(is_full()) {
+                // non blocking overflow policy
+                if(policy == OverflowPolicy::DropNewest) {
+                    num_dropped++;
+                    mu.unlock();
+                    return waited;
+                }
+                if(policy == OverflowPolicy::DropOldest) {
+                    pop();
+                    num_dropped++;
+                }
+                else {
+                    grow();
+                }
+            }
+            push(std::move(data), tag);
             
             // unlock & notify order problem: https://stackoverflow.com/questions/17101922/do-i-have-to-acquire-lock-before-calling-condition-variable-notify-one/17102100#17102100
             mu.unlock();
             
             // when a datum is enqueued, the queue must be non-empty, notify the consumer to unlock wait
             cond_not_empty.notify_all(); 
+            return waited;
+        }
+
+        /* Non-blocking produce: return false instead of waiting when the queue is full */
+        bool try_produce(data_t data) {
+            mu.lock();
+            if(is_full()) {
+                drop_expired();
+            }
+            if(is_full() || closed) {
+                mu.unlock();
+                return false;
+            }
+            push(std::move(data));
+            mu.unlock();
+            cond_not_empty.notify_all(); 
+            return true;
         }
 
         data_t consume() {
+            tag_t tag;
+            return consume(tag);
+        }
+
+        // also return the tag the datum was produced with
+        data_t consume(tag_t& tag) {
             mu.lock();
+            drop_expired();
             while(is_empty()) {
                 // freeze this thread until queue is not empty
                 cond_not_empty.wait(mu); 
+                drop_expired();
             }
-            data_t rtn = cp_queue.front();
-            cp_queue.pop();
+            data_t rtn = pop(&tag);
+            maybe_shrink();
             mu.unlock();
 
             // when a datum is dequeued, the queue must be not-full, notify the producer to unlock wait
@@ -45,16 +223,19 @@ class ConsumerProducerQueue {
             return rtn;
         }
 
-        /* Timed consume: on timeout (unit: milliseconds), return dft_rtn (default return value) */
-        data_t consume(unsigned int timeout_ms, data_t dft_rtn) {
-            boost::system_time const timeout = boost::get_system_time()+ boost::posix_time::milliseconds(timeout_ms);
+        /* Timed consume: on timeout (unit: milliseconds, of ITPS::Clock), return dft_rtn (default return value)
+         * and leave *tag untouched */
+        data_t consume(unsigned int timeout_ms, data_t dft_rtn, tag_t *tag = nullptr) {
+            ITPS::Clock::time_point const timeout = ITPS::Clock::now() + boost::chrono::milliseconds(timeout_ms);
             bool fulfilled = true;
             mu.lock();
+            drop_expired();
             while(is_empty()) {
                 // freeze this thread until queue is not empty or timed out
-                if(cond_not_empty.timed_wait(mu, timeout)) {
+                if(cond_not_empty.wait_until(mu, timeout)) {
                     // if wait returns due to condition being fulfilled
                     fulfilled = true;
+                    drop_expired();
                 } 
                 else {
                     // if wait returns due to time out
@@ -64,8 +245,8 @@ class ConsumerProducerQueue {
             }
 
             if(fulfilled) {
-                data_t rtn = cp_queue.front();
-                cp_queue.pop();
+                data_t rtn = pop(tag);
+                maybe_shrink();
                 mu.unlock();
 
                 // when a datum is dequeued, the queue must be not-full, notify the producer to unlock wait
@@ -78,22 +259,124 @@ class ConsumerProducerQueue {
             }
         }
 
+        /* Blocking consume that gives up once the queue is closed: return false when the
+         * queue is closed and drained, otherwise pop the next datum into data */
+        bool consume_until_closed(data_t& data, tag_t *tag = nullptr) {
+            mu.lock();
+            drop_expired();
+            while(is_empty() && !closed) {
+                cond_not_empty.wait(mu);
+                drop_expired();
+            }
+            if(is_empty()) {
+                mu.unlock();
+                return false;
+            }
+            data = pop(tag);
+            maybe_shrink();
+            mu.unlock();
+            cond_not_full.notify_all();
+            return true;
+        }
+
+        /* Non-blocking consume: return false instead of waiting when the queue is empty */
+        bool try_consume(data_t& data, tag_t *tag = nullptr) {
+            mu.lock();
+            drop_expired();
+            if(is_empty()) {
+                mu.unlock();
+                return false;
+            }
+            data = pop(tag);
+            maybe_shrink();
+            mu.unlock();
+            cond_not_full.notify_all();
+            return true;
+        }
+
         bool is_full() const {
-            return cp_queue.size() >= max_size;
+            return count >= max_size;
         }
 
         bool is_empty() const {
-            return cp_queue.size() <= 0;
+            return count <= 0;
         }
 
         unsigned int size() const {
-            return cp_queue.size();
+            return count;
+        }
+
+        unsigned int capacity() const {
+            return max_size;
+        }
+
+        /* Switch the overflow policy, producers currently blocked on a full queue re-check
+         * it, so switching away from Block releases them */
+        void set_overflow_policy(OverflowPolicy policy) {
+            mu.lock();
+            this->policy = policy;
+            mu.unlock();
+            cond_not_full.notify_all();
+        }
+
+        /* Data older than ttl get discarded, zero (default) disables it. Stamps are kept in a
+         * side ring allocated by the first call, data queued before it count as produced now */
+        void set_ttl(boost::chrono::steady_clock::duration ttl) {
+            mu.lock();
+            if(ttl > ttl.zero() && stamps.empty()) {
+                stamps.assign(max_size, ITPS::Clock::now());
+            }
+            this->ttl = ttl;
+            mu.unlock();
+            cond_not_full.notify_all(); // blocked producers start waiting for expiry
+        }
+
+        // number of data discarded by the DropNewest / DropOldest policies or expired
+        unsigned long dropped() {
+            boost::lock_guard<boost::mutex> guard(mu);
+            return num_dropped;
+        }
+
+        struct stall_state_t {
+            boost::chrono::steady_clock::duration stalled; // zero if no producer is blocked
+            unsigned long stall_id; // incremented every time a stall begins
+            unsigned int size, capacity;
+        };
+
+        /* How long the longest waiting producer has been blocked on a full queue */
+        stall_state_t stall_state() {
+            boost::lock_guard<boost::mutex> guard(mu);
+            stall_state_t state;
+            state.stalled = blocked_producers == 0 ? boost::chrono::steady_clock::duration::zero() :
+                                                     boost::chrono::steady_clock::now() - blocked_since;
+            state.stall_id = num_stalls;
+            state.size = count;
+            state.capacity = max_size;
+            return state;
+        }
+
+        /* Once closed, produce() drops data instead of blocking, and producers that are 
+         * currently blocked on a full queue return. Data already queued can still be consumed.
+         * consume_until_closed() returns false once the remaining data is drained.
+         */
+        void close() {
+            mu.lock();
+            closed = true;
+            mu.unlock();
+            cond_not_full.notify_all();
+            cond_not_empty.notify_all();
+        }
+
+        void reopen() {
+            mu.lock();
+            closed = false;
+            mu.unlock();
         }
 
         void clear() {
             mu.lock();
             while(!is_empty()) {
-                cp_queue.pop();
+                pop();
             }
             mu.unlock();
             cond_not_full.notify_all();
@@ -101,14 +384,115 @@ class ConsumerProducerQueue {
 
 
     private:
+        // both called with mu held
+        void push(data_t&& data, tag_t tag = 0) {
+            tags[tail] = tag;
+            if(!stamps.empty()) {
+                stamps[tail] = ITPS::Clock::now();
+            }
+            ring[tail] = std::move(data);
+            tail = (tail + 1 == max_size) ? 0 : tail + 1;
+            count++;
+        }
+
+        // OverflowPolicy::Expand, double the capacity regardless of max_size & budget
+        void grow() {
+            unsigned int new_size = std::max(2 * max_size, 1u);
+            QueueBudget::charge(slot_bytes(new_size - max_size));
+            resize(new_size);
+        }
+
+        // elastic growth by a chunk
+        void try_grow() {
+            if(max_size >= max_cap) return;
+            unsigned int new_size = std::min(max_size + chunk_size, max_cap);
+            if(QueueBudget::try_charge(slot_bytes(new_size - max_size))) {
+                resize(new_size);
+                low_streak = 0;
+            }
+        }
+
+        void maybe_shrink() {
+            if(max_size <= min_size) return;
+            low_streak = (count <= max_size / 4) ? low_streak + 1 : 0;
+            if(low_streak < max_size) return;
+
+            unsigned int new_size = std::max(std::max(min_size, count), max_size > chunk_size ? max_size - chunk_size : 0u);
+            QueueBudget::release(slot_bytes(max_size - new_size));
+            resize(new_size);
+            low_streak = 0;
+        }
+
+        // move the data into a ring of new_size slots, oldest datum first
+        void resize(unsigned int new_size) {
+            std::vector<data_t> new_ring(new_size);
+            for(unsigned int i = 0; i < count; i++) {
+                new_ring[i] = std::move(ring[(head + i) % max_size]);
+            }
+            ring.swap(new_ring);
+            std::vector<tag_t> new_tags(new_size);
+            for(unsigned int i = 0; i < count; i++) {
+                new_tags[i] = tags[(head + i) % max_size];
+            }
+            tags.swap(new_tags);
+            if(!stamps.empty()) {
+                std::vector<ITPS::Clock::time_point> new_stamps(new_size);
+                for(unsigned int i = 0; i < count; i++) {
+                    new_stamps[i] = stamps[(head + i) % max_size];
+                }
+                stamps.swap(new_stamps);
+            }
+            head = 0;
+            tail = new_size == 0 ? 0 : count % new_size;
+            max_size = new_size;
+        }
+
+        // discard the expired data at the head, the oldest ones
+        void drop_expired() {
+            if(ttl == ttl.zero() || is_empty()) return;
+            ITPS::Clock::time_point now = ITPS::Clock::now();
+            while(!is_empty() && stamps[head] + ttl <= now) {
+                pop();
+                num_dropped++;
+            }
+        }
+
+        static size_t slot_bytes(unsigned int num_slots) {
+            return size_t(num_slots) * (sizeof(data_t) + sizeof(tag_t));
+        }
+
+        data_t pop(tag_t *tag = nullptr) {
+            if(tag) {
+                *tag = tags[head];
+            }
+            // move out, so that a slot doesn't keep resources (e.g. a Pooled msg) alive
+            data_t rtn = std::move(ring[head]);
+            head = (head + 1 == max_size) ? 0 : head + 1;
+            count--;
+            return rtn;
+        }
 
         static unsigned int millis(void) {
             auto t = boost::chrono::high_resolution_clock::now();
             return (unsigned int)(double(t.time_since_epoch().count()) / 1000000.00f);
         }
 
-        boost::mutex mu;
-        boost::condition_variable_any cond_not_full, cond_not_empty;
-        std::queue<data_t> cp_queue;
-        unsigned int max_size;
+        boost::mutex mu; // guards everything below
+        unsigned int count = 0;
+        bool closed = false;
+        std::vector<data_t> ring;
+        std::vector<tag_t> tags; // one per slot of ring
+        std::vector<ITPS::Clock::time_point> stamps; // produce() times, empty until set_ttl()
+        boost::chrono::steady_clock::duration ttl = boost::chrono::steady_clock::duration::zero();
+        unsigned int max_size; // current capacity
+        unsigned int min_size, max_cap, chunk_size = 1; // elastic bounds, min_size == max_cap if fixed
+        unsigned int low_streak = 0;
+        OverflowPolicy policy = OverflowPolicy::Block;
+        unsigned long num_dropped = 0;
+        unsigned int blocked_producers = 0;
+        unsigned long num_stalls = 0;
+        boost::chrono::steady_clock::time_point blocked_since;
+        unsigned int head = 0, tail = 0;
+        ITPS::ClockCondition cond_not_full;
+        ITPS::ClockCondition cond_not_empty;
 };
\ No newline at end of file
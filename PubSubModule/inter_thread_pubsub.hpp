@@ -7,25 +7,59 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <limits>
+#include <optional>
+#include <cassert>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
+#include <boost/chrono.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/signals2.hpp>
 
 #include "cp_queue.hpp"
+#include "topic_trie.hpp"
+#include "msg_pool.hpp"
+#include "byte_ring.hpp"
+#include "delegate.hpp"
+#include "stall_watchdog.hpp"
+#include "reorder_buffer.hpp"
+#include "tracer.hpp"
+#include "realtime.hpp"
 
 
 /* Synchronization for Reader/Writer problems */
-// get exclusive access
-#define ITPS_writer_lock(mutex) do { \
+// get exclusive access (held until the end of the enclosing scope)
+#define ITPS_writer_lock(mutex) \
     boost::upgrade_lock<boost::shared_mutex> __writer_lock(mutex); \
-    boost::upgrade_to_unique_lock<boost::shared_mutex> __unique_writer_lock( __writer_lock ); \
-}while(0)
+    boost::upgrade_to_unique_lock<boost::shared_mutex> __unique_writer_lock( __writer_lock );
 // get shared access
 #define ITPS_reader_lock(mutex) boost::shared_lock<boost::shared_mutex>  __reader_lock(mutex); 
 
 #define Default_Topic "DefaultTopic"
 
+/* Declare a typed topic descriptor, e.g.
+ *      ITPS_TOPIC(SensorA, double);
+ *      Publisher<SensorA> pub;     Subscriber<SensorA> sub(100);
+ * the msg type is carried by the descriptor, check ITPS::TopicDescriptor.
+ * Its channel is "DefaultTopic.SensorA" wherever it's declared: descriptors of the same name
+ * (& msg type) in different namespaces share it, give them a topic with ITPS_TOPIC_IN */
+#define ITPS_TOPIC(name, msg_type) \
+    struct name : ITPS::TopicDescriptor<msg_type> { \
+        static const char* msg_name() { return #name; } \
+    }
+
+/* Typed topic descriptor on an explicit topic, e.g. ITPS_TOPIC_IN("robot1", SensorA, double)
+ * has the channel "robot1.SensorA" */
+#define ITPS_TOPIC_IN(topic, name, msg_type) \
+    struct name : ITPS::TopicDescriptor<msg_type> { \
+        static const char* topic_name() { return topic; } \
+        static const char* msg_name() { return #name; } \
+    }
+
 
 
 
@@ -68,116 +102,973 @@ namespace ITPS {
      *      * MQ mode's getter function "Msg pop_msg(void)" is conditionally blocking, when
      *        the queue is empty, getter's thread gets blocked until something is published into the queue.
      *        Similarly, when the queue is full, the publisher is blocked instead. 
+     *
+     *  * Observer callbacks are stored as Delegates (check delegate.hpp), inline in the slot,
+     *    and receive the msg by const reference. Subscriber::add_observer(observer) registers
+     *    an object whose on_update(const Msg&) gets called without any type erasure left
+     *    but the thunk's function pointer.
+     *
+     *  * Content filters: a subscriber may register a predicate (any callable or functor
+     *    object of the form bool pred(const Msg&)) through Subscriber::set_filter(). The
+     *    predicate is evaluated by the publisher inside MsgChannel::set_msg() before the msg
+     *    is copied into the subscriber's queue or handed to its callback, so rejected msgs
+     *    cost neither a copy nor a wakeup of the consumer thread.
+     *
+     *  * Rate-limited subscriptions: Subscriber::set_max_rate(), set_min_interval() and
+     *    set_decimation() attach a Throttle to each slot of the subscriber, checked right
+     *    after the content filter on the publish path with ITPS::Clock, so a 10 Hz view
+     *    of a 1 kHz topic only costs the publisher 10 copies per second.
+     *
+     *  * Wildcard subscriptions: a subscriber whose key contains "*" (one segment) or "**"
+     *    (any number of segments) e.g. Subscriber<double>("Topic1", "*", 100), gets its queue
+     *    and callbacks attached to every matching channel, both the ones that already exist
+     *    (looked up through a TopicTrie index) and the ones created by later publishers.
+     *    Key segments are separated by '.' or '/'. Trivial mode isn't available for wildcards.
+     *    Channels are typed, so a Subscriber<double> wildcard only matches channels of double
+     *    msgs, a std::string channel with a matching key is ignored.
+     *
+     *  * Late-joining subscribers: a publisher may ask for a history depth N, the channel then
+     *    keeps the last N msgs in a ring preallocated at construction. A queue subscriber that
+     *    subscribes later is seeded with those msgs (oldest first, as many as fit in its queue),
+     *    atomically with respect to ongoing publishes, so it sees a gapless stream as long as
+     *    it joins within N msgs. Observer callbacks are not replayed.
+     *
+     *  * Subscription churn: the queues & callbacks of a channel are kept in an immutable
+     *    snapshot, publishers only take a reference to the current snapshot and iterate it
+     *    without holding any lock that subscribers contend on. Subscribing / unsubscribing
+     *    copies the list and swaps the new snapshot in, RCU style. A publisher still holding
+     *    an old snapshot keeps the removed queues alive through their shared_ptr (they are
+     *    closed, so msgs get dropped), and checks a per-callback liveness flag before invoking
+     *    a callback; removal waits only for callbacks of the removed subscriber that are
+     *    already running. Subscriber::unsubscribe() is called by the destructor, so a dead
+     *    subscriber costs the publishers nothing.
+     *    Note: don't destroy / unsubscribe a subscriber from within one of its own callbacks,
+     *    removal would wait for the callback itself.
+     *
+     *  * Multiple publishers: publishers constructed with the same key share one channel,
+     *    each of them owning a single-writer lane (latest msg + history ring), so publishers
+     *    never contend with each other. Subscribers receive the merged stream of all lanes;
+     *    latest_msg() and history seeding merge the lanes in publish order. A subscriber
+     *    may ask for a timestamp-ordered merge of the live stream as well
+     *    (Subscriber::set_ordered_merge()), which serializes the publishers of that channel
+     *    until the last such subscriber unsubscribes.
+     *    The channel is reference-counted by its publishers & subscribers, the hash table only
+     *    holds a weak reference, except for channels with a history which the table keeps
+     *    alive for late subscribers.
+     *
+     *  * Typed topics: ITPS_TOPIC(SensorA, double) declares a descriptor type, Publisher<SensorA>
+     *    and Subscriber<SensorA> then publish / receive doubles, a typo in the topic or a msg
+     *    of the wrong type is a compile error. The channel is resolved once per descriptor into
+     *    a static slot, so constructing & subscribing doesn't hash any string, and subscribe()
+     *    always succeeds. The descriptor's channel is the one of msg_name "SensorA" on the
+     *    Default_Topic, so string-named Subscriber<double>("SensorA") can still join it.
+     *    ITPS_TOPIC_IN("robot1", SensorA, double) puts it on the topic "robot1" instead.
+     *
+     *  * Elastic queues: Subscriber(topic_name, msg_name, initial_queue_size, max_queue_size)
+     *    gets a queue that grows by chunks on bursts and shrinks back when idle. All queues
+     *    share a process-wide memory budget (QueueBudget::set_limit()), when an elastic queue
+     *    can't grow the subscriber's OverflowPolicy applies (set_overflow_policy()).
+     *
+     *  * Versioned latest value: each channel counts its publishes. Subscriber::latest() returns
+     *    an std::optional msg (empty before the first publish) with that version, has_new()
+     *    tells whether anything was published since, and wait_newer() sleeps until a newer
+     *    version shows up, so latest-value readers don't need to poll.
+     *
+     *  * Consumer groups: queue subscribers that call join_group(name) before subscribe() share
+     *    a single MPMC queue per group & channel, each msg goes to exactly one member of the
+     *    group, so a heavy topic can be spread over a pool of workers. Msgs of the group are
+     *    numbered in publish order (pop_sequenced()), a Reorderer (check reorder_buffer.hpp)
+     *    puts the workers' results back in that order.
+     *
+     *  * Lazy publishing: Publisher::has_subscribers() tells whether any queue, callback or
+     *    latest-value subscriber is attached, publish_lazy(factory) only builds the msg when
+     *    one is (or when the channel keeps a history), so dormant topics cost next to nothing.
+     *
+     *  * Byte rings: a string / blob subscriber may queue its msgs as variable-length records
+     *    stored inline in one preallocated buffer (Subscriber::set_byte_ring()) and read them
+     *    in place as a std::string_view, queueing then costs a copy of the bytes and no
+     *    allocation. Check byte_ring.hpp.
+     *
+     *  * Freshness: Subscriber::set_ttl() discards msgs that waited in the queue for longer
+     *    than a time-to-live, at pop and when a publisher finds the queue full.
+     *
+     *  * Stall watchdog: a publisher blocks while one of its subscriber queues is full. An
+     *    ITPS::StallWatchdog (opt-in, check stall_watchdog.hpp) reports publishers blocked
+     *    longer than a threshold with the channel key, the subscriber and its queue depth, and
+     *    may switch the offending queue to a non-blocking OverflowPolicy (check cp_queue.hpp).
+     *
+     *  * Tracing: ITPS::Tracer::enable() records publishes, enqueues, publishers blocked on
+     *    full queues, pops and callbacks with the channel key and the msg's version, and dumps
+     *    them as a Chrome trace (check tracer.hpp). Disabled, it costs one flag check.
+     *
+     *  * Virtual time: every timeout, rate limit and publish stamp reads ITPS::Clock, a steady
+     *    clock unless a VirtualClock is installed, which jumps to the next deadline as soon as
+     *    every participant thread is blocked (simulations & tests run as fast as the CPU
+     *    allows). Check virtual_clock.hpp.
+     *
+     *  * Request / response: ITPS::Service<Req, Resp> & Client<Req, Resp> (check rpc.hpp), a
+     *    call returns a future, the reply goes straight to the caller by correlation id.
+     *
+     *  * Real-time topics: Publisher / Subscriber ::set_realtime() plus RealTime::configure()
+     *    at startup (locked, pre-faulted memory), with a debug hook aborting on any allocation
+     *    while publishing / popping on an RT topic. Check realtime.hpp.
+     *
+     *  * Pooled Mode: for large payloads, use Msg = ITPS::Pooled<T> and borrow the msg from
+     *    the channel's pool with Publisher::loan(). Check msg_pool.hpp for details.
+     */
+
+
+    // bumped by every publish on a channel, 0 means nothing published yet
+    typedef unsigned long long version_t;
+
+    /* latest msg of a channel along with its version, msg is empty before the first publish */
+    template<class Msg>
+    struct Versioned {
+        std::optional<Msg> msg;
+        version_t version = 0;
+    };
+
+    // subscriber_id_t is declared in stall_watchdog.hpp
+    // 0 is reserved for slots that don't belong to any subscriber
+    inline subscriber_id_t next_subscriber_id() {
+        static std::atomic<subscriber_id_t> counter{0};
+        return ++counter;
+    }
+
+
+    /* Publisher-side rate limiter of a single subscription slot.
+     * Admits every n-th msg and/or at most one msg per min_interval. The state is kept in
+     * atomics so that the check stays lock-free on the publish path.
      */
+    class Throttle {
+        public:
+            typedef boost::chrono::steady_clock clock_type;
+
+            Throttle(unsigned int every_nth, clock_type::duration min_interval) {
+                this->every_nth = every_nth;
+                this->min_interval = min_interval.count();
+            }
+
+            // same limits, fresh state
+            boost::shared_ptr<Throttle> clone() const {
+                return boost::shared_ptr<Throttle>(new Throttle(every_nth, clock_type::duration(min_interval)));
+            }
+
+            bool admit() {
+                if(every_nth > 1 && (msg_count.fetch_add(1, std::memory_order_relaxed) % every_nth) != 0) {
+                    return false;
+                }
+                if(min_interval > 0) {
+                    long long now = Clock::now().time_since_epoch().count();
+                    long long last = last_admitted.load(std::memory_order_relaxed);
+                    if(now - last < min_interval) {
+                        return false;
+                    }
+                    // lost the race against another publisher admitting at the same time
+                    return last_admitted.compare_exchange_strong(last, now, std::memory_order_relaxed);
+                }
+                return true;
+            }
+
+        private:
+            unsigned int every_nth;
+            long long min_interval; // unit: clock_type ticks
+            std::atomic<unsigned long long> msg_count{0};
+            std::atomic<long long> last_admitted{std::numeric_limits<long long>::min() / 2};
+    };
+
+    /* Everything the publisher evaluates before delivering a msg to one subscription slot */
+    template<class Msg>
+    struct SlotGate {
+        Delegate<bool(const Msg&)> filter; // empty filter accepts every msg
+        boost::shared_ptr<Throttle> throttle; // nullptr == no rate limit
+
+        bool admit(const Msg& msg) const {
+            if(filter && !filter(msg)) return false;
+            if(throttle && !throttle->admit()) return false;
+            return true;
+        }
+
+        // copy of this gate that doesn't share the throttle state
+        SlotGate fresh() const {
+            SlotGate gate;
+            gate.filter = filter;
+            if(throttle) gate.throttle = throttle->clone();
+            return gate;
+        }
+    };
 
 
     /* This class serves as a bridge between the Publisher class and the Subcribe class*/ 
     template<class Msg>
     class MsgChannel {
         protected:
+            struct table_entry_t {
+                boost::weak_ptr<MsgChannel<Msg>> channel;
+                // channels with a history are pinned by the table, so that the history stays
+                // reachable for late subscribers after every publisher is gone
+                boost::shared_ptr<MsgChannel<Msg>> durable;
+            };
 
             // unordered map == hash map
-            typedef std::unordered_map<std::string, MsgChannel<Msg>*> msg_table_t;
+            typedef std::unordered_map<std::string, table_entry_t> msg_table_t;
         public:
+            // publisher-side content filter stored inline, an empty filter accepts every msg
+            typedef Delegate<bool(const Msg&)> filter_t;
+            // observer callbacks get the publisher's msg by reference, stored inline (check delegate.hpp)
+            typedef Delegate<void(const Msg&)> callback_t;
+            typedef boost::chrono::steady_clock::time_point stamp_t;
+            typedef typename msg_pool_traits<Msg>::pool_type pool_t;
 
-            MsgChannel(std::string topic_name, std::string msg_name) {
-                ITPS_writer_lock(table_mutex);
+            /* Single-writer state of one publisher. Only its publisher writes it, joining
+             * subscribers and latest-value readers take its mutex briefly to read it. */
+            // cache line aligned, publishers on different lanes don't contend on a line
+            struct alignas(ITPS_CACHE_LINE) lane_t {
+                struct stamped_t {
+                    stamp_t stamp;
+                    version_t version; // total publish order, stamps may tie (e.g. on a VirtualClock)
+                    Msg msg;
+                };
+
+                lane_t(size_t history_depth) : history(history_depth) {}
+
+                // grow the history ring to depth, the msgs it holds are kept in order
+                void resize_history(size_t depth) {
+                    if(depth <= history.size()) return;
+                    std::vector<stamped_t> grown(depth);
+                    for(size_t i = 0; i < history_count; i++) {
+                        grown[i] = history[(history_head + history.size() - history_count + i) % history.size()];
+                    }
+                    history.swap(grown);
+                    history_head = history_count % depth;
+                }
+
+                boost::mutex mutex;
+                bool active = true; // false once its publisher is gone, it can be adopted by a new one
+                bool has_msg = false;
+                stamped_t latest;
+                std::vector<stamped_t> history; // ring of the last history.size() msgs, preallocated
+                size_t history_head = 0, history_count = 0;
+            };
+
+            MsgChannel(std::string topic_name, std::string msg_name, unsigned int history_depth = 0)
+                : slots(new slot_list_t()) {
                 this->key = topic_name + "." + msg_name;
+                this->history_depth = history_depth;
+                this->trace_key = Tracer::intern(key);
+            }
+
+            /* return the channel registered under the key, instantiating & registering it
+             * into the hash table if there's none (or if it has already been destroyed) */
+            static boost::shared_ptr<MsgChannel> create(std::string topic_name, std::string msg_name, unsigned int history_depth = 0) {
+                std::string key = topic_name + "." + msg_name;
                 // std::cout << key << std::endl;
                 
-                // if key doesn't exist
-                if(msg_table.find(key) == msg_table.end()) {
-                    msg_table[key] = this;
+                ITPS_writer_lock(table_mutex);
+                table_entry_t& entry = msg_table[key];
+                boost::shared_ptr<MsgChannel> channel = entry.channel.lock();
+                if(channel == nullptr) {
+                    channel = boost::shared_ptr<MsgChannel>(new MsgChannel(topic_name, msg_name, history_depth));
+                    entry.channel = channel;
+                    channel_index.insert(key);
+
+                    // attach wildcard subscriptions that were made before this publisher appeared
+                    TopicTrie::segments_t segments = TopicTrie::split(key);
+                    for(auto& sub: wildcard_subs) {
+                        if(TopicTrie::matches(sub.pattern, segments)) {
+                            channel->attach(sub);
+                        }
+                    }
+                }
+                else {
+                    channel->reserve_history(history_depth);
+                }
+
+                if(history_depth > 0) {
+                    entry.durable = channel;
                 }
+                return channel;
             }
 
-            static MsgChannel *get_channel(std::string topic_name, std::string msg_name) {
+            static boost::shared_ptr<MsgChannel> get_channel(std::string topic_name, std::string msg_name) {
                 ITPS_reader_lock(table_mutex);
                 std::string key = topic_name + "." + msg_name;
                 
                 // if key doesn't exist
-                if(msg_table.find(key) == msg_table.end()) {
+                auto entry = msg_table.find(key);
+                if(entry == msg_table.end()) {
                     return nullptr;
                 }
-                return msg_table[key];
+                return entry->second.channel.lock(); // nullptr if every publisher & subscriber is gone
+            }
+
+            /* Subscribe a queue (queue != nullptr) or a callback to every channel whose key
+             * matches the wildcard pattern, now and in the future. Only channels of this Msg
+             * type: every Msg type has its own table */
+            static void add_wildcard_subscription(std::string pattern,
+                                                  boost::shared_ptr<ConsumerProducerQueue<Msg>> queue,
+                                                  callback_t callback_function,
+                                                  SlotGate<Msg> gate,
+                                                  subscriber_id_t owner = 0) {
+                ITPS_writer_lock(table_mutex);
+                wildcard_sub_t sub = {TopicTrie::split(pattern), queue, callback_function, gate, owner};
+                for(auto& key: channel_index.match(sub.pattern)) {
+                    boost::shared_ptr<MsgChannel> channel = msg_table[key].channel.lock();
+                    if(channel != nullptr) {
+                        channel->attach(sub);
+                    }
+                }
+                wildcard_subs.push_back(sub);
             }
 
-            void add_msg_queue(boost::shared_ptr<ConsumerProducerQueue<Msg>> queue) {
-                ITPS_writer_lock(msg_mutex); 
-                msg_queues.push_back(queue);
+            /* Forget the wildcard subscriptions of owner and detach them from every channel.
+             * The table lock is released before detaching, which waits for running callbacks:
+             * channels created meanwhile don't get the subscription anymore */
+            static void remove_wildcard_subscriptions(subscriber_id_t owner) {
+                std::vector<boost::shared_ptr<MsgChannel>> channels;
+                {
+                    ITPS_writer_lock(table_mutex);
+                    wildcard_subs.erase(std::remove_if(wildcard_subs.begin(), wildcard_subs.end(),
+                        [owner](const wildcard_sub_t& sub) { return sub.owner == owner; }), wildcard_subs.end());
+                    for(auto& entry: msg_table) {
+                        boost::shared_ptr<MsgChannel> channel = entry.second.channel.lock();
+                        if(channel != nullptr) {
+                            channels.push_back(channel);
+                        }
+                    }
+                }
+                for(auto& channel: channels) {
+                    channel->remove_slots(owner);
+                }
+            }
+
+            /* A lane per publisher: publishers of the same channel don't share a lane lock,
+             * they still share the channel's version counter and the atomic_load of its slot
+             * list. The lane of a destroyed publisher (and its history) is handed over to the
+             * next publisher that joins, grown to the channel's current history depth, so the
+             * number of lanes never exceeds the peak number of concurrent publishers. */
+            boost::shared_ptr<lane_t> open_lane() {
+                ITPS_writer_lock(lanes_mutex);
+                for(auto& lane: lanes) {
+                    if(!lane->active) {
+                        boost::lock_guard<boost::mutex> guard(lane->mutex);
+                        size_t depth = lane->history.size();
+                        lane->resize_history(history_depth);
+                        pool.reserve(lane->history.size() - depth);
+                        lane->active = true;
+                        return lane;
+                    }
+                }
+                // the lane's history + latest msg + the msg being filled by its publisher
+                pool.reserve(history_depth + 2);
+                lanes.push_back(boost::shared_ptr<lane_t>(new lane_t(history_depth)));
+                return lanes.back();
+            }
+
+            void close_lane(boost::shared_ptr<lane_t> lane) {
+                ITPS_writer_lock(lanes_mutex);
+                lane->active = false;
+            }
+
+            /* Deliver the msgs of every publisher in timestamp order, at the cost of serializing
+             * the publishers of this channel, as long as at least one subscriber asks for it.
+             * Reference-counted: the publishers run unserialized again once the last ordered
+             * subscriber called remove_ordered_merge() */
+            void add_ordered_merge() {
+                num_ordered_subscribers++;
+            }
+
+            void remove_ordered_merge() {
+                num_ordered_subscribers--;
+            }
+
+            // RT topic: publishes & pops run inside a RealTime::HotPath scope
+            void enable_realtime() {
+                realtime = true;
+            }
+
+            bool is_realtime() const {
+                return realtime.load(std::memory_order_relaxed);
+            }
+
+            // latest-value (Trivial Mode) subscribers, they have no slot
+            void add_reader() {
+                num_readers++;
+            }
+
+            void remove_reader() {
+                num_readers--;
+            }
+
+            // a queue, a callback or a latest-value reader is attached
+            bool has_subscribers() const {
+                return num_slots.load(std::memory_order_relaxed) + num_readers.load(std::memory_order_relaxed) > 0;
+            }
+
+            // someone may read a msg published now: a subscriber, or late ones through the history
+            bool has_interest() const {
+                return has_subscribers() || history_depth.load(std::memory_order_relaxed) > 0;
+            }
+
+            void add_msg_queue(boost::shared_ptr<ConsumerProducerQueue<Msg>> queue,
+                               SlotGate<Msg> gate = SlotGate<Msg>(), subscriber_id_t owner = 0) {
+                // seeding and insertion must not interleave with a publish on any lane
+                ITPS_writer_lock(lanes_mutex);
+                std::vector<boost::unique_lock<boost::mutex>> lane_locks;
+                for(auto& lane: lanes) {
+                    lane_locks.push_back(boost::unique_lock<boost::mutex>(lane->mutex));
+                }
+                size_t pooled = queue->capacity();
+                pool.reserve(pooled);
+                QueueRegistry::instance().add(key, owner, queue);
+                seed_from_history(queue, gate);
+                update_slots([&](slot_list_t& list) {
+                    list.queues.push_back({queue, gate, owner, pooled});
+                });
+            }
+
+            /* Byte ring of a string / blob subscriber (Msg with byte_msg_traits), the payload
+             * is copied inline into the ring, seeded from the history like a queue */
+            void add_byte_ring(boost::shared_ptr<ByteRing> ring,
+                               SlotGate<Msg> gate = SlotGate<Msg>(), subscriber_id_t owner = 0) {
+                static_assert(byte_msg_traits<Msg>::value, "byte rings carry std::string or std::vector<char / unsigned char> msgs");
+                ITPS_writer_lock(lanes_mutex);
+                std::vector<boost::unique_lock<boost::mutex>> lane_locks;
+                for(auto& lane: lanes) {
+                    lane_locks.push_back(boost::unique_lock<boost::mutex>(lane->mutex));
+                }
+                seed_from_history(*ring, gate);
+                update_slots([&](slot_list_t& list) {
+                    list.rings.push_back({ring, gate, owner});
+                });
             }
 
-            void add_slot(boost::function<void(Msg)> callback_function) {
-                callback_funcs.push_back(callback_function);
+            void add_slot(callback_t callback_function,
+                          SlotGate<Msg> gate = SlotGate<Msg>(), subscriber_id_t owner = 0) {
+                update_slots([&](slot_list_t& list) {
+                    list.callbacks.push_back({callback_function, gate, owner, boost::shared_ptr<callback_guard_t>(new callback_guard_t())});
+                });
             }
 
-            void set_msg(Msg msg) {
-                ITPS_writer_lock(msg_mutex);
-                this->message = msg;
+            /* add_slot() only if no queue, ring or callback is attached yet (checked & added
+             * atomically), return false otherwise. For exclusive consumers such as an rpc
+             * Service */
+            bool add_sole_slot(callback_t callback_function,
+                               SlotGate<Msg> gate = SlotGate<Msg>(), subscriber_id_t owner = 0) {
+                bool added = false;
+                update_slots([&](slot_list_t& list) {
+                    if(!list.queues.empty() || !list.callbacks.empty() || !list.rings.empty()) return;
+                    list.callbacks.push_back({callback_function, gate, owner, boost::shared_ptr<callback_guard_t>(new callback_guard_t())});
+                    added = true;
+                });
+                return added;
+            }
+
+            /* Remove every queue & callback of owner. On return none of owner's callbacks is
+             * running or will be invoked anymore, so whatever they refer to may be destroyed.
+             * (the owner is expected to close its queue, publishers holding an older snapshot
+             * may still try to push into it) */
+            void remove_slots(subscriber_id_t owner) {
+                boost::shared_ptr<const slot_list_t> old = update_slots([owner](slot_list_t& list) {
+                    list.queues.erase(std::remove_if(list.queues.begin(), list.queues.end(),
+                        [owner](const queue_slot_t& slot) { return slot.owner == owner; }), list.queues.end());
+                    list.callbacks.erase(std::remove_if(list.callbacks.begin(), list.callbacks.end(),
+                        [owner](const callback_slot_t& slot) { return slot.owner == owner; }), list.callbacks.end());
+                    list.rings.erase(std::remove_if(list.rings.begin(), list.rings.end(),
+                        [owner](const ring_slot_t& slot) { return slot.owner == owner; }), list.rings.end());
+                });
+
+                for(auto& slot: old->queues) {
+                    if(slot.owner == owner) pool.release(slot.pooled);
+                }
+                for(auto& slot: old->callbacks) {
+                    if(slot.owner != owner) continue;
+                    slot.guard->alive = false;
+                    // wait for invocations that passed the liveness check before it was cleared
+                    while(slot.guard->running > 0) {
+                        boost::this_thread::yield();
+                    }
+                }
+            }
+
+            /* A consumer group: one queue slot shared by its members, the group unsubscribes
+             * from the channel when its last member lets go of it */
+            struct group_t {
+                subscriber_id_t id; // owner of the group's slot
+                boost::shared_ptr<ConsumerProducerQueue<Sequenced<Msg>>> queue;
+                MsgChannel *channel; // every member holds the channel
+
+                ~group_t() {
+                    queue->close(); // releases publishers blocked on it
+                    channel->remove_slots(id);
+                }
+            };
+
+            /* return the group of that name, creating it with a queue of queue_size and the
+             * gate of its first member if there's none */
+            boost::shared_ptr<group_t> join_group(std::string name, unsigned int queue_size, SlotGate<Msg> gate) {
+                boost::lock_guard<boost::mutex> guard(groups_mutex);
+                boost::shared_ptr<group_t> group = groups[name].lock();
+                if(group != nullptr) {
+                    return group;
+                }
+
+                group = boost::shared_ptr<group_t>(new group_t());
+                group->id = next_subscriber_id();
+                group->queue = boost::shared_ptr<ConsumerProducerQueue<Sequenced<Msg>>>(
+                    new ConsumerProducerQueue<Sequenced<Msg>>(queue_size)
+                );
+                group->channel = this;
+                groups[name] = group;
+
+                /* numbered on the publisher's thread. Numbering & enqueueing are atomic, so the
+                 * queue holds seqs in order: a worker can never wait in a Reorderer for a seq
+                 * that's still stuck behind a full queue */
+                struct sequencer_t {
+                    boost::mutex mutex;
+                    sequence_t next_seq = 0;
+                };
+                boost::shared_ptr<sequencer_t> sequencer(new sequencer_t());
+                boost::shared_ptr<ConsumerProducerQueue<Sequenced<Msg>>> queue = group->queue;
+                add_slot([queue, sequencer](const Msg& msg) {
+                    boost::lock_guard<boost::mutex> guard(sequencer->mutex);
+                    queue->produce({sequencer->next_seq++, msg}, Tracer::publishing());
+                }, gate, group->id);
+                QueueRegistry::instance().add(key + " (group " + name + ")", group->id, queue);
+                return group;
+            }
+
+            // return the number of queues, rings & callbacks the msg was delivered to
+            unsigned int set_msg(lane_t& lane, const Msg& msg) {
+                bool tracing = Tracer::enabled();
+                long long publish_start = tracing ? Tracer::now() : 0;
+                version_t seq;
+                unsigned int delivered = 0;
+
+                boost::unique_lock<boost::mutex> merge_lock(merge_mutex, boost::defer_lock);
+                if(num_ordered_subscribers > 0) {
+                    // stamp & fan-out of every lane happen in one total order
+                    merge_lock.lock();
+                }
+
+                // the snapshot stays valid for the whole fan-out even if subscribers come and go
+                boost::shared_ptr<const slot_list_t> snapshot;
+                {
+                    /* Updating the history and taking the snapshot is atomic with respect to
+                     * add_msg_queue(): a new queue either is in the snapshot, or got this msg
+                     * from the history. The lock is released before the fan-out, so subscribers
+                     * never wait for a publisher blocked on a full queue. */
+                    boost::lock_guard<boost::mutex> lane_lock(lane.mutex);
+                    lane.latest.stamp = Clock::now();
+                    lane.latest.msg = msg;
+                    lane.has_msg = true;
+                    seq = ++version; // under the lane lock, a reader seeing the version finds the msg
+                    lane.latest.version = seq;
                 
+                    if(!lane.history.empty()) {
+                        lane.history[lane.history_head] = lane.latest;
+                        lane.history_head = (lane.history_head + 1) % lane.history.size();
+                        if(lane.history_count < lane.history.size()) lane.history_count++;
+                    }
+
+                    snapshot = boost::atomic_load(&slots);
+                }
+                
+                if(num_waiters > 0) {
+                    // taking the mutex orders this with a waiter between its check & its wait
+                    { boost::lock_guard<boost::mutex> guard(version_mutex); }
+                    version_changed.notify_all();
+                }
+
                 /* enqueue MQ*/
-                for(auto& queue: msg_queues) {
-                    queue->produce(msg);
+                for(auto& slot: snapshot->queues) {
+                    // filtered out before the copy, the consumer thread is never woken up
+                    if(!slot.gate.admit(msg)) continue;
+                    delivered++;
+                    if(!tracing) {
+                        slot.queue->produce(msg);
+                        continue;
+                    }
+                    long long start = Tracer::now();
+                    bool waited = slot.queue->produce(msg, Tracer::tag(trace_key, seq));
+                    Tracer::record(waited ? Tracer::BlockedOnFull : Tracer::Enqueue, trace_key, seq, start, Tracer::now(), slot.owner);
+                }
+
+                /* copy into the byte rings, no allocation per subscriber */
+                if constexpr(byte_msg_traits<Msg>::value) {
+                    for(auto& slot: snapshot->rings) {
+                        if(!slot.gate.admit(msg)) continue;
+                        slot.ring->produce(byte_msg_traits<Msg>::bytes(msg));
+                        delivered++;
+                    }
                 }
 
                 /* invoke observer's callback functions */
-                for(auto& func: callback_funcs) {
-                    func(msg);
+                Tracer::PublishScope publish_scope(tracing, Tracer::tag(trace_key, seq)); // consumer groups tag their msgs with it
+                for(auto& slot: snapshot->callbacks) {
+                    if(!slot.gate.admit(msg)) continue;
+                    // publishers iterating an old snapshot must not call back a removed subscriber
+                    slot.guard->running++;
+                    if(slot.guard->alive) {
+                        long long start = tracing ? Tracer::now() : 0;
+                        slot.func(msg);
+                        delivered++;
+                        if(tracing) Tracer::record(Tracer::Callback, trace_key, seq, start, Tracer::now(), slot.owner);
+                    }
+                    slot.guard->running--;
                 }
 
+                if(tracing) Tracer::record(Tracer::Publish, trace_key, seq, publish_start, Tracer::now());
+                return delivered;
+            }
+
+            // only available for Msg = Pooled<T>
+            pool_t& msg_pool() {
+                return pool;
             }
 
+            // newest msg over all the lanes
             Msg get_msg() { 
-                ITPS_reader_lock(msg_mutex);
-                return this->message;
+                Msg msg = Msg();
+                newest_msg(msg);
+                return msg;
+            }
+
+            version_t get_version() const {
+                return version;
+            }
+
+            Versioned<Msg> get_versioned() {
+                Versioned<Msg> versioned;
+                Msg msg = Msg();
+                // the version of the msg actually read, a publish racing with this is seen as newer
+                if(newest_msg(msg, &versioned.version)) {
+                    versioned.msg = msg;
+                }
+                return versioned;
+            }
+
+            /* block until the version exceeds last_version or timeout_ms elapsed, on timeout the
+             * returned msg is empty */
+            Versioned<Msg> wait_newer(version_t last_version, unsigned int timeout_ms) {
+                num_waiters++;
+                bool newer;
+                {
+                    boost::unique_lock<boost::mutex> lock(version_mutex);
+                    newer = version_changed.wait_until(lock, Clock::now() + boost::chrono::milliseconds(timeout_ms),
+                                                       [&]() { return version > last_version; });
+                }
+                num_waiters--;
+                if(!newer) {
+                    Versioned<Msg> versioned;
+                    versioned.version = last_version;
+                    return versioned;
+                }
+                return get_versioned();
             }
 
         protected:
-            Msg message;
+            bool newest_msg(Msg& msg, version_t *msg_version = nullptr) {
+                ITPS_reader_lock(lanes_mutex);
+                bool found = false;
+                version_t newest = 0;
+                for(auto& lane: lanes) {
+                    boost::lock_guard<boost::mutex> lane_lock(lane->mutex);
+                    if(lane->has_msg && (!found || lane->latest.version > newest)) {
+                        msg = lane->latest.msg;
+                        newest = lane->latest.version;
+                        found = true;
+                    }
+                }
+                if(msg_version) *msg_version = newest;
+                return found;
+            }
+
+            struct queue_slot_t {
+                boost::shared_ptr<ConsumerProducerQueue<Msg>> queue;
+                SlotGate<Msg> gate;
+                subscriber_id_t owner;
+                size_t pooled; // pool slots reserved for it, released on removal
+            };
+
+            struct callback_guard_t {
+                std::atomic<bool> alive{true};
+                std::atomic<int> running{0};
+            };
+
+            struct callback_slot_t {
+                callback_t func;
+                SlotGate<Msg> gate;
+                subscriber_id_t owner;
+                boost::shared_ptr<callback_guard_t> guard;
+            };
+
+            struct ring_slot_t {
+                boost::shared_ptr<ByteRing> ring;
+                SlotGate<Msg> gate;
+                subscriber_id_t owner;
+            };
+
+            // immutable once published through `slots`
+            struct slot_list_t {
+                std::vector<queue_slot_t> queues;
+                std::vector<callback_slot_t> callbacks;
+                std::vector<ring_slot_t> rings; // only for byte msgs
+            };
+
+            struct wildcard_sub_t {
+                TopicTrie::segments_t pattern;
+                boost::shared_ptr<ConsumerProducerQueue<Msg>> queue; // nullptr for callback subscriptions
+                callback_t func;
+                SlotGate<Msg> gate; // prototype, every attached channel gets its own throttle state
+                subscriber_id_t owner;
+            };
+
+            /* copy-on-write update of the slot list, returns the replaced snapshot */
+            template<class Edit>
+            boost::shared_ptr<const slot_list_t> update_slots(Edit edit) {
+                boost::lock_guard<boost::mutex> guard(slots_mutex);
+                boost::shared_ptr<const slot_list_t> old = boost::atomic_load(&slots);
+                boost::shared_ptr<slot_list_t> next(new slot_list_t(*old));
+                edit(*next);
+                num_slots = next->queues.size() + next->callbacks.size() + next->rings.size();
+                boost::atomic_store(&slots, boost::shared_ptr<const slot_list_t>(next));
+                return old;
+            }
+
+            // a publisher joining with a deeper history, lanes opened from now on get it
+            void reserve_history(unsigned int depth) {
+                ITPS_writer_lock(lanes_mutex);
+                if(depth > history_depth) history_depth = depth;
+            }
+
+            /* must hold every lane's mutex: the newest history msgs (merged over all lanes in
+             * publish order) that pass the filter and fit into the queue's free room are pushed,
+             * oldest first */
+            void seed_from_history(boost::shared_ptr<ConsumerProducerQueue<Msg>> queue, const SlotGate<Msg>& gate) {
+                std::vector<const typename lane_t::stamped_t*> picked = history_msgs(gate);
+                size_t room = queue->capacity() - queue->size();
+                size_t count = std::min(picked.size(), std::min(room, (size_t) history_depth));
+                for(size_t i = picked.size() - count; i < picked.size(); i++) {
+                    // a wildcard queue may be filled concurrently by other channels, never block here
+                    if(!queue->try_produce(picked[i]->msg)) break;
+                }
+            }
+
+            // same for a byte ring, as many of the newest msgs as fit in its free bytes
+            void seed_from_history(ByteRing& ring, const SlotGate<Msg>& gate) {
+                std::vector<const typename lane_t::stamped_t*> picked = history_msgs(gate);
+                size_t room = ring.capacity() - ring.bytes_used();
+                size_t count = 0;
+                while(count < std::min(picked.size(), (size_t) history_depth)) {
+                    size_t bytes = ByteRing::record_bytes(byte_msg_traits<Msg>::bytes(picked[picked.size() - 1 - count]->msg).size());
+                    if(bytes > room) break;
+                    room -= bytes;
+                    count++;
+                }
+                for(size_t i = picked.size() - count; i < picked.size(); i++) {
+                    if(!ring.try_produce(byte_msg_traits<Msg>::bytes(picked[i]->msg))) break;
+                }
+            }
+
+            // the history msgs of every lane passing the filter, in publish order
+            std::vector<const typename lane_t::stamped_t*> history_msgs(const SlotGate<Msg>& gate) {
+                typedef typename lane_t::stamped_t stamped_t;
+                std::vector<const stamped_t*> picked;
+                for(auto& lane: lanes) {
+                    for(size_t i = 1; i <= lane->history_count; i++) {
+                        const stamped_t& entry = lane->history[(lane->history_head + lane->history.size() - i) % lane->history.size()];
+                        if(gate.filter && !gate.filter(entry.msg)) continue;
+                        picked.push_back(&entry);
+                    }
+                }
+                std::sort(picked.begin(), picked.end(), [](const stamped_t* a, const stamped_t* b) {
+                    return a->version < b->version;
+                });
+                return picked;
+            }
+
+            void attach(const wildcard_sub_t& sub) {
+                if(sub.queue != nullptr) {
+                    add_msg_queue(sub.queue, sub.gate.fresh(), sub.owner);
+                }
+                else {
+                    add_slot(sub.func, sub.gate.fresh(), sub.owner);
+                }
+            }
+
             static msg_table_t msg_table;
-            
-            boost::shared_mutex msg_mutex;
+            static TopicTrie channel_index;
+            static std::vector<wildcard_sub_t> wildcard_subs;
             static boost::shared_mutex table_mutex;
 
+            // read-mostly, written when publishers join / leave
             std::string key;
+            const Tracer::key_t *trace_key;
+            std::vector<boost::shared_ptr<lane_t>> lanes;
+            boost::shared_mutex lanes_mutex;
+            std::atomic<unsigned int> history_depth; // read by publish_lazy()
+
+            // written by every publish() in ordered mode
+            alignas(ITPS_CACHE_LINE) std::atomic<unsigned int> num_ordered_subscribers{0};
+            boost::mutex merge_mutex;
+            std::atomic<bool> realtime{false};
+
+            pool_t pool; // NoPool unless Msg is a Pooled<T>
+
+            std::unordered_map<std::string, boost::weak_ptr<group_t>> groups;
+            boost::mutex groups_mutex;
+
+            // latest-value readers
+            alignas(ITPS_CACHE_LINE) std::atomic<version_t> version{0};
+            std::atomic<unsigned int> num_waiters{0};
+            boost::mutex version_mutex;
+            ClockCondition version_changed;
+
+            // read by every publish(), written when subscribers come & go
+            alignas(ITPS_CACHE_LINE) boost::shared_ptr<const slot_list_t> slots; // read by publishers with boost::atomic_load
+            std::atomic<size_t> num_slots{0}, num_readers{0};
+            boost::mutex slots_mutex; // serializes the writers of slots
+    };
+
+
+
+
+
+    /* Base of the types declared with ITPS_TOPIC(name, msg_type), ITPS_TOPIC_IN hides
+     * topic_name() */
+    template<class Msg>
+    struct TopicDescriptor {
+        typedef Msg msg_type;
+        static const char* topic_name() { return Default_Topic; }
+    };
+
+    /* Resolve the template argument of Publisher / Subscriber, either a msg type
+     * (string-named topics) or a topic descriptor */
+    template<class T, class Enable = void>
+    struct topic_traits {
+        typedef T msg_type;
+        static const bool is_descriptor = false;
 
-            std::vector< boost::shared_ptr<ConsumerProducerQueue<Msg>> > msg_queues;
-            std::vector< boost::function<void(Msg)> > callback_funcs;
+        static boost::shared_ptr<MsgChannel<msg_type>> find_channel(std::string topic_name, std::string msg_name) {
+            return MsgChannel<msg_type>::get_channel(topic_name, msg_name);
+        }
     };
 
+    template<class T>
+    struct topic_traits<T, typename std::enable_if<std::is_base_of<TopicDescriptor<typename T::msg_type>, T>::value>::type> {
+        typedef typename T::msg_type msg_type;
+        static const bool is_descriptor = true;
 
+        // static per-descriptor slot, the table lookup only happens on first use
+        static const boost::shared_ptr<MsgChannel<msg_type>>& channel() {
+            static const boost::shared_ptr<MsgChannel<msg_type>> slot =
+                MsgChannel<msg_type>::create(T::topic_name(), T::msg_name());
+            return slot;
+        }
 
+        static boost::shared_ptr<MsgChannel<msg_type>> find_channel(std::string, std::string) {
+            return channel();
+        }
+    };
 
 
-    template <class Msg>
+    /* T: either the msg type, or a topic descriptor declared with ITPS_TOPIC */
+    template <class T>
     class Publisher {
         public:
 
-            Publisher(std::string topic_name, std::string msg_name) {
-                channel = boost::shared_ptr<ITPS::MsgChannel<Msg>>(new ITPS::MsgChannel<Msg>(topic_name, msg_name));
+            typedef typename topic_traits<T>::msg_type Msg;
+
+            /* history_depth: number of past msgs kept to seed queue subscribers joining late
+             * several publishers may share the same key, each one gets its own lane */
+            Publisher(std::string topic_name, std::string msg_name, unsigned int history_depth = 0) {
+                static_assert(!topic_traits<T>::is_descriptor, "the topic of a descriptor is fixed, use Publisher(history_depth)");
+                channel = ITPS::MsgChannel<Msg>::create(topic_name, msg_name, history_depth);
+                lane = channel->open_lane();
             }
 
             Publisher(std::string msg_name) : Publisher(Default_Topic, msg_name) {}
+            Publisher(std::string msg_name, unsigned int history_depth) : Publisher(Default_Topic, msg_name, history_depth) {}
+
+            // typed topic
+            Publisher(unsigned int history_depth = 0) {
+                static_assert(topic_traits<T>::is_descriptor, "Publisher<Msg> needs a key, or use a descriptor declared with ITPS_TOPIC");
+                channel = topic_traits<T>::channel();
+                if(history_depth > 0) {
+                    MsgChannel<Msg>::create(T::topic_name(), T::msg_name(), history_depth);
+                }
+                lane = channel->open_lane();
+            }
+
+            // the lane is bound to this object's identity
+            Publisher(const Publisher&) = delete;
+            Publisher& operator=(const Publisher&) = delete;
+
+            ~Publisher() {
+                channel->close_lane(lane);
+            }
 
-            ~Publisher() {}
+            /* return the number of subscriber queues, rings & callbacks that got the msg
+             * (latest-value readers aren't counted, they read it from the channel) */
+            unsigned int publish(Msg message) {
+                RealTime::HotPath hot_path(channel->is_realtime());
+                return channel->set_msg(*lane, message);
+            }
+
+            /* true if a queue, callback or latest-value subscriber is attached to the channel
+             * (two relaxed atomic loads) */
+            bool has_subscribers() const {
+                return channel->has_subscribers();
+            }
+
+            /* Build & publish a msg only if someone may read it: factory() (returning a Msg) is
+             * only invoked when has_subscribers() is true, or when the channel keeps a history
+             * for late subscribers. Return whether it published. Dormant diagnostic topics then
+             * cost one atomic load per publish_lazy().
+             * A latest-value subscriber subscribing later finds no msg until the next publish.
+             */
+            template<class Factory>
+            bool publish_lazy(Factory factory) {
+                if(!channel->has_interest()) return false;
+                publish(factory());
+                return true;
+            }
 
-            void publish(Msg message) {
-                channel->set_msg(message);
+            /* Make the channel an RT topic (check realtime.hpp): with realtime_alloc_hook.cpp
+             * linked in, an allocation while publishing or popping on it aborts */
+            void set_realtime() {
+                channel->enable_realtime();
+            }
+
+            /* Pooled Mode only (Msg = Pooled<T>): borrow a msg slot from the channel's pool,
+             * fill it, then publish() it */
+            Msg loan() {
+                return channel->msg_pool().loan();
+            }
+
+            PoolStats pool_stats() {
+                return channel->msg_pool().stats();
             }
 
 
         protected:
             boost::shared_ptr<ITPS::MsgChannel<Msg>> channel;
+            boost::shared_ptr<typename ITPS::MsgChannel<Msg>::lane_t> lane;
             
     };
 
-    template <class Msg>
+    /* T: either the msg type, or a topic descriptor declared with ITPS_TOPIC */
+    template <class T>
     class Subscriber {
         public:
+            typedef typename topic_traits<T>::msg_type Msg;
 
             Subscriber(std::string topic_name, std::string msg_name) {
+                static_assert(!topic_traits<T>::is_descriptor, "the topic of a descriptor is fixed, use Subscriber() or Subscriber(queue_size)");
                 this->topic_name = topic_name;
                 this->msg_name = msg_name;
+                this->id = next_subscriber_id();
             }
             Subscriber(std::string msg_name) : Subscriber(Default_Topic, msg_name){}
 
@@ -191,9 +1082,174 @@ namespace ITPS {
             } 
             Subscriber(std::string msg_name, unsigned int queue_size) : Subscriber(Default_Topic, msg_name, queue_size){}
             
-            ~Subscriber() {}
+            /* with an elastic message queue: starts with initial_queue_size slots, grows by
+             * that many slots up to max_queue_size as long as the global QueueBudget allows,
+             * and shrinks back after sustained low occupancy. Check cp_queue.hpp */
+            Subscriber(std::string topic_name, std::string msg_name, unsigned int initial_queue_size, unsigned int max_queue_size)
+                : Subscriber(topic_name, msg_name) {
+                msg_queue = boost::shared_ptr<ConsumerProducerQueue<Msg>>(
+                    new ConsumerProducerQueue<Msg>(initial_queue_size, max_queue_size, initial_queue_size)
+                );
+                use_msg_queue = true;
+            }
+
+            // typed topic
+            Subscriber() {
+                static_assert(topic_traits<T>::is_descriptor, "Subscriber<Msg> needs a key, or use a descriptor declared with ITPS_TOPIC");
+                this->topic_name = T::topic_name();
+                this->msg_name = T::msg_name();
+                this->id = next_subscriber_id();
+            }
+
+            // typed topic with message queue
+            Subscriber(unsigned int queue_size) : Subscriber() {
+                msg_queue = boost::shared_ptr<ConsumerProducerQueue<Msg>>(
+                    new ConsumerProducerQueue<Msg>(queue_size) 
+                );
+                use_msg_queue = true;
+            }
+            
+            // typed topic with elastic message queue
+            Subscriber(unsigned int initial_queue_size, unsigned int max_queue_size) : Subscriber() {
+                msg_queue = boost::shared_ptr<ConsumerProducerQueue<Msg>>(
+                    new ConsumerProducerQueue<Msg>(initial_queue_size, max_queue_size, initial_queue_size)
+                );
+                use_msg_queue = true;
+            }
+            
+            // the subscription is bound to this object's identity
+            Subscriber(const Subscriber&) = delete;
+            Subscriber& operator=(const Subscriber&) = delete;
+
+            ~Subscriber() {
+                unsubscribe();
+            }
+
+
+            /* Register a publisher-side content filter of the format
+             *  bool pred(const Msg& msg);
+             * Either a function pointer or a functor object (e.g. a struct with a
+             * bool operator()(const Msg&) const) can be passed. Only msgs for which the
+             * predicate returns true are enqueued into this subscriber's queue or passed to
+             * its callbacks; the check runs on the publisher's thread before any copy.
+             * The functor is stored in a Delegate, inline unless it's bigger than
+             * ITPS_DELEGATE_CAPACITY, its type is kept in the thunk the publisher calls, so its
+             * body gets inlined there (check delegate.hpp).
+             *
+             * must be called before subscribe() / add_on_published_callback() to take effect
+             */
+            template<class Filter>
+            void set_filter(Filter filter) {
+                this->filter = typename MsgChannel<Msg>::filter_t(std::move(filter));
+            }
+
+            /* Rate-limited subscriptions, enforced by the publisher with a steady clock.
+             * The limits apply to msgs that passed the content filter, each queue/callback
+             * slot of this subscriber is throttled independently.
+             * 
+             * must be called before subscribe() / add_on_published_callback() to take effect
+             */
+            // deliver at most max_rate_hz msgs per second, 0 disables the limit
+            void set_max_rate(double max_rate_hz) {
+                min_interval = max_rate_hz > 0 ?
+                    boost::chrono::duration_cast<Throttle::clock_type::duration>(boost::chrono::duration<double>(1.0 / max_rate_hz)) :
+                    Throttle::clock_type::duration::zero();
+            }
 
+            // deliver at most one msg per interval_ms milliseconds
+            void set_min_interval(unsigned int interval_ms) {
+                min_interval = boost::chrono::milliseconds(interval_ms);
+            }
 
+            // deliver only every n-th msg, 0 or 1 delivers every msg
+            void set_decimation(unsigned int every_nth) {
+                this->every_nth = every_nth;
+            }
+
+            /* Join the consumer group group_name of the channel: the members of a group share
+             * one queue (created with the queue size & filter / rate settings of the first
+             * member) and each msg is popped by only one of them. The member's own queue is
+             * freed right away (and given back to the QueueBudget). Queue subscribers only,
+             * not available for wildcards.
+             *
+             * must be called before subscribe() to take effect
+             */
+            void join_group(std::string group_name) {
+                if(!use_msg_queue || is_wildcard() || channel != nullptr) return;
+                this->group_name = group_name;
+                if(msg_queue != nullptr) {
+                    group_queue_size = msg_queue->capacity();
+                    msg_queue.reset();
+                }
+            }
+
+            /* What the publisher does when this subscriber's queue is full (and, for elastic
+             * queues, can't grow anymore): block (default), drop the new msg, or overwrite
+             * the oldest one. Check OverflowPolicy in cp_queue.hpp
+             * Not applied to consumer groups, their queue always blocks: a dropped msg would
+             * leave a gap in the group's sequence that a Reorderer waits for forever. */
+            void set_overflow_policy(OverflowPolicy policy) {
+                if(msg_queue != nullptr) {
+                    msg_queue->set_overflow_policy(policy);
+                }
+            }
+
+            /* Freshness deadline: msgs that sat in this subscriber's queue for longer than
+             * ttl_ms (of ITPS::Clock) are discarded at pop, or when a publisher finds the queue
+             * full, and count as dropped(). After a stall, pop_msg() returns fresh msgs instead
+             * of the backlog. 0 disables it (default). Not applied to consumer groups.
+             */
+            void set_ttl(unsigned int ttl_ms) {
+                if(msg_queue != nullptr) {
+                    msg_queue->set_ttl(boost::chrono::milliseconds(ttl_ms));
+                }
+            }
+
+            // msgs discarded by the overflow policy or expired
+            unsigned long dropped() {
+                return msg_queue != nullptr ? msg_queue->dropped() : 0;
+            }
+
+            /* Have the channel deliver msgs from all of its publishers in publish timestamp
+             * order. This serializes the publishers of the channel, for every subscriber, until
+             * the last ordered subscriber unsubscribes.
+             *
+             * must be called before subscribe() to take effect, not available for wildcards
+             */
+            void set_ordered_merge(bool ordered) {
+                this->ordered_merge = ordered;
+            }
+
+            /* Make the channel an RT topic (check realtime.hpp), pops of this subscriber run
+             * inside a RealTime::HotPath scope. Use a fixed-size queue, elastic ones allocate
+             * when they grow.
+             *
+             * must be called before subscribe() to take effect, not available for wildcards
+             */
+            void set_realtime() {
+                this->realtime = true;
+            }
+
+            /* For string / blob topics (std::string, std::vector<char / unsigned char>): queue
+             * the msgs as records stored inline in a ring of capacity_bytes instead of a msg
+             * queue, so queueing a msg doesn't allocate, and read them in place with acquire()
+             * & release(). Check byte_ring.hpp.
+             *
+             * For a subscriber constructed without a queue size only (it's the ring instead of
+             * the queue), not available for wildcards, must be called before subscribe().
+             * Return false (and change nothing) otherwise.
+             *
+             * The ring is a plain queue of bytes: it isn't listed in the QueueRegistry (so the
+             * StallWatchdog doesn't see it), set_overflow_policy() / set_ttl() / dropped() don't
+             * apply (a full ring blocks the publishers) and the Tracer records no Enqueue /
+             * Dequeue events for it. pop_msg() & co. are for queue subscribers, use acquire().
+             */
+            bool set_byte_ring(size_t capacity_bytes) {
+                static_assert(byte_msg_traits<Msg>::value, "byte rings carry std::string or std::vector<char / unsigned char> msgs");
+                if(use_msg_queue || is_wildcard() || channel != nullptr) return false;
+                byte_ring = boost::shared_ptr<ByteRing>(new ByteRing(capacity_bytes));
+                return true;
+            }
 
 
             /* return true if finding a msg channel with matching key string.
@@ -201,31 +1257,236 @@ namespace ITPS {
              * the msg channel is created during the constructing phase
              * of the corresponding publisher with the same key string.
              * The MsgChannel object is stored in a internally global hash-map
+             *
+             * wildcard keys (containing "*" or "**") always return true, the
+             * queue gets attached to matching channels whenever they appear
              */
             bool subscribe() {
-                channel = MsgChannel<Msg>::get_channel(topic_name, msg_name);
+                if(msg_queue != nullptr) {
+                    msg_queue->reopen(); // in case of a previous unsubscribe()
+                }
+                if(byte_ring) {
+                    byte_ring->reopen();
+                }
+                if(is_wildcard()) {
+                    if(use_msg_queue) {
+                        MsgChannel<Msg>::add_wildcard_subscription(topic_name + "." + msg_name,
+                                                                   msg_queue, callback_t(), make_gate(), id);
+                    }
+                    wildcard_subscribed = true;
+                    return true;
+                }
+                channel = topic_traits<T>::find_channel(topic_name, msg_name);
                 if(channel == nullptr) {
                     return false;
                 }
-                if(use_msg_queue) {
-                    channel->add_msg_queue(msg_queue);
+                if(ordered_merge && !merging) {
+                    channel->add_ordered_merge();
+                    merging = true;
+                }
+                if(realtime) {
+                    channel->enable_realtime();
+                }
+                realtime = channel->is_realtime(); // the publisher may have made it an RT topic
+                if(use_msg_queue && !group_name.empty()) {
+                    group = channel->join_group(group_name, group_queue_size, make_gate());
+                    group_queue = group->queue; // stays poppable after unsubscribe()
+                }
+                else if(use_msg_queue) {
+                    channel->add_msg_queue(msg_queue, make_gate(), id);
+                }
+                else if(byte_ring) {
+                    if constexpr(byte_msg_traits<Msg>::value) {
+                        channel->add_byte_ring(byte_ring, make_gate(), id);
+                    }
+                }
+                else if(!reading) {
+                    channel->add_reader();
+                    reading = true;
                 }
                 return true;
             }
 
+            // set_filter(filter) then subscribe()
+            template<class Filter>
+            bool subscribe(Filter&& filter) {
+                set_filter(std::forward<Filter>(filter));
+                return subscribe();
+            }
+
+            /* Detach this subscriber's queue and callbacks from the channel(s). Publishers
+             * blocked on this subscriber's full queue are released, and once this returns
+             * none of its callbacks is running or will be invoked again.
+             * Msgs already in the queue can still be popped.
+             */
+            void unsubscribe() {
+                if(msg_queue != nullptr) {
+                    msg_queue->close();
+                }
+                if(byte_ring) {
+                    byte_ring->close();
+                }
+                if(wildcard_subscribed) {
+                    MsgChannel<Msg>::remove_wildcard_subscriptions(id);
+                    wildcard_subscribed = false;
+                }
+                else if(channel != nullptr) {
+                    channel->remove_slots(id);
+                }
+                if(reading) {
+                    channel->remove_reader();
+                    reading = false;
+                }
+                if(merging) {
+                    channel->remove_ordered_merge();
+                    merging = false;
+                }
+                group.reset(); // the last member out unsubscribes the group, before the channel may go
+                channel.reset();
+            }
+
             // For Trivial Mode only
             Msg latest_msg() {
                 return channel->get_msg();
             }   
 
+            /* For Trivial Mode: latest msg with the channel version, the msg is empty before
+             * the first publish (or if not subscribed) */
+            Versioned<Msg> latest() {
+                if(channel == nullptr) return Versioned<Msg>();
+                Versioned<Msg> versioned = channel->get_versioned();
+                last_version = versioned.version;
+                return versioned;
+            }
+
+            // true if something was published since the last latest() / wait_newer()
+            bool has_new() const {
+                return channel != nullptr && channel->get_version() > last_version;
+            }
+
+            /* Sleep until a msg newer than last_version is published, or timeout_ms elapsed
+             * (empty msg), instead of polling latest_msg() */
+            Versioned<Msg> wait_newer(version_t last_version, unsigned int timeout_ms) {
+                if(channel == nullptr) return Versioned<Msg>();
+                Versioned<Msg> versioned = channel->wait_newer(last_version, timeout_ms);
+                if(versioned.msg) this->last_version = versioned.version;
+                return versioned;
+            }
+
+            // newer than what this subscriber read last
+            Versioned<Msg> wait_newer(unsigned int timeout_ms) {
+                return wait_newer(last_version, timeout_ms);
+            }
+
             // For Message Queue Mode only
             Msg pop_msg() {
-                return msg_queue->consume();
+                RealTime::HotPath hot_path(realtime);
+                tag_t tag;
+                if(group_queue) {
+                    Msg msg = group_queue->consume(tag).msg;
+                    trace_dequeue(tag);
+                    return msg;
+                }
+                assert(msg_queue != nullptr && "pop_msg() on a subscriber without a msg queue (byte ring subscribers use acquire())");
+                Msg msg = msg_queue->consume(tag);
+                trace_dequeue(tag);
+                return msg;
             }
 
             // with time limit, if surpassing the timeout limit, return dft_rtn (default return value) 
             Msg pop_msg(unsigned int timeout_ms, Msg dft_rtn) {
-                return msg_queue->consume(timeout_ms, dft_rtn);
+                RealTime::HotPath hot_path(realtime);
+                tag_t tag = 0; // stays 0 on timeout
+                if(group_queue) {
+                    Msg msg = group_queue->consume(timeout_ms, {0, dft_rtn}, &tag).msg;
+                    trace_dequeue(tag);
+                    return msg;
+                }
+                assert(msg_queue != nullptr && "pop_msg() on a subscriber without a msg queue (byte ring subscribers use acquire())");
+                if(msg_queue == nullptr) return dft_rtn;
+                Msg msg = msg_queue->consume(timeout_ms, dft_rtn, &tag);
+                trace_dequeue(tag);
+                return msg;
+            }
+
+            // non-blocking, return false if there's no msg to pop
+            bool try_pop_msg(Msg& msg) {
+                RealTime::HotPath hot_path(realtime);
+                tag_t tag;
+                if(group_queue) {
+                    Sequenced<Msg> sequenced;
+                    if(!group_queue->try_consume(sequenced, &tag)) return false;
+                    msg = sequenced.msg;
+                    trace_dequeue(tag);
+                    return true;
+                }
+                assert(msg_queue != nullptr && "try_pop_msg() on a subscriber without a msg queue (byte ring subscribers use try_acquire())");
+                if(msg_queue == nullptr) return false;
+                if(!msg_queue->try_consume(msg, &tag)) return false;
+                trace_dequeue(tag);
+                return true;
+            }
+
+            /* block until a msg is available and pop it into msg, return false once
+             * unsubscribe() was called and the queue is drained (e.g. to end a consumer thread)
+             * for a consumer group, once the whole group is gone */
+            bool wait_msg(Msg& msg) {
+                RealTime::HotPath hot_path(realtime);
+                tag_t tag;
+                if(group_queue) {
+                    Sequenced<Msg> sequenced;
+                    if(!group_queue->consume_until_closed(sequenced, &tag)) return false;
+                    msg = sequenced.msg;
+                    trace_dequeue(tag);
+                    return true;
+                }
+                assert(msg_queue != nullptr && "wait_msg() on a subscriber without a msg queue (byte ring subscribers use acquire())");
+                if(msg_queue == nullptr) return false;
+                if(!msg_queue->consume_until_closed(msg, &tag)) return false;
+                trace_dequeue(tag);
+                return true;
+            }
+
+            // For consumer groups only: pop the msg along with its seq number in the group
+            Sequenced<Msg> pop_sequenced() {
+                RealTime::HotPath hot_path(realtime);
+                tag_t tag;
+                Sequenced<Msg> sequenced = group_queue->consume(tag);
+                trace_dequeue(tag);
+                return sequenced;
+            }
+
+            bool wait_sequenced(Sequenced<Msg>& sequenced) {
+                RealTime::HotPath hot_path(realtime);
+                tag_t tag;
+                if(!group_queue->consume_until_closed(sequenced, &tag)) return false;
+                trace_dequeue(tag);
+                return true;
+            }
+
+            /* For byte ring mode only: block until a msg is available and view it in place,
+             * the view is valid until release(). Return false once unsubscribe() was called
+             * and the ring is drained */
+            bool acquire(std::string_view& msg) {
+                RealTime::HotPath hot_path(realtime);
+                return byte_ring->acquire(msg);
+            }
+
+            // with time limit, false on timeout
+            bool acquire(std::string_view& msg, unsigned int timeout_ms) {
+                RealTime::HotPath hot_path(realtime);
+                return byte_ring->acquire(msg, timeout_ms);
+            }
+
+            // non-blocking, return false if there's no msg
+            bool try_acquire(std::string_view& msg) {
+                RealTime::HotPath hot_path(realtime);
+                return byte_ring->try_acquire(msg);
+            }
+
+            // done with the msg of the last acquire(), its bytes go back to the publishers
+            void release() {
+                byte_ring->release();
             }
 
             /* For Observer Mode: function pointer version.
@@ -233,24 +1494,93 @@ namespace ITPS {
              * Add callback function to be invoked whenever 
              * a new Msg is published to the msg channel. The 
              * callback function should be of the format 
-             *  void func_name(Msg msg);
+             *  void func_name(const Msg& msg);   (or void func_name(Msg msg), which copies it)
              * where the msg param is the published message to be 
-             * handled in the callback.
+             * handled in the callback. Any callable can be passed (function pointer, lambda,
+             * boost::bind, boost::function), it's stored in the slot's Delegate, inline unless
+             * it's bigger than ITPS_DELEGATE_CAPACITY (same as set_filter(), check delegate.hpp).
              * 
              * must call subcribe() and get a return of true, before calling this function
              */
-            bool add_on_published_callback(boost::function<void(Msg)> callback_function) {
+            template<class Callback>
+            bool add_on_published_callback(Callback callback_function) {
+                return add_callback(callback_t(std::move(callback_function)));
+            }
+
+            /* For Observer Mode, statically typed: the publisher calls observer.on_update(msg)
+             * (or the member function Method, e.g. add_observer<&Logger::log>(logger)) through
+             * a thunk where both are known at compile time, the msg passed by reference. The
+             * observer must outlive the subscription.
+             */
+            template<class Observer>
+            bool add_observer(Observer& observer) {
+                return add_observer<&Observer::on_update>(observer);
+            }
+
+            template<auto Method, class Observer>
+            bool add_observer(Observer& observer) {
+                return add_callback(callback_t::template bind<Method>(&observer));
+            }
+
+
+        protected:
+            typedef typename MsgChannel<Msg>::callback_t callback_t;
+
+            bool add_callback(callback_t callback_function) {
+                if(wildcard_subscribed) {
+                    MsgChannel<Msg>::add_wildcard_subscription(topic_name + "." + msg_name,
+                                                               nullptr, callback_function, make_gate(), id);
+                    return true;
+                }
                 if(channel == nullptr) return false;
-                channel->add_slot(callback_function);    
+                channel->add_slot(callback_function, make_gate(), id);
                 return true;            
             }    
 
+            bool is_wildcard() const {
+                return TopicTrie::is_pattern(topic_name) || TopicTrie::is_pattern(msg_name);
+            }
 
-        protected:
-            MsgChannel<Msg> *channel = nullptr;
+            typedef typename ConsumerProducerQueue<Msg>::tag_t tag_t;
+
+            /* the tag names the channel & seq of the publish (check Tracer::tag()), the one of
+             * a wildcard subscriber's msg is the matched channel's. Untagged msgs were queued
+             * while tracing was off */
+            void trace_dequeue(tag_t tag) {
+                if(tag != 0 && Tracer::enabled()) {
+                    Tracer::record_tagged(Tracer::Dequeue, tag, Tracer::now(), 0, id);
+                }
+            }
+
+            // every slot gets its own throttle state
+            SlotGate<Msg> make_gate() {
+                SlotGate<Msg> gate;
+                gate.filter = filter;
+                if(every_nth > 1 || min_interval > Throttle::clock_type::duration::zero()) {
+                    gate.throttle = boost::shared_ptr<Throttle>(new Throttle(every_nth, min_interval));
+                }
+                return gate;
+            }
+
+            boost::shared_ptr<MsgChannel<Msg>> channel;
             boost::shared_ptr<ConsumerProducerQueue<Msg>> msg_queue;
+            boost::shared_ptr<ByteRing> byte_ring;
+            version_t last_version = 0;
+            std::string group_name;
+            boost::shared_ptr<typename MsgChannel<Msg>::group_t> group;
+            boost::shared_ptr<ConsumerProducerQueue<Sequenced<Msg>>> group_queue;
+            unsigned int group_queue_size = 0; // capacity of the group's queue if this member creates it
             std::string topic_name, msg_name;
+            subscriber_id_t id;
             bool use_msg_queue = false;
+            bool wildcard_subscribed = false;
+            bool ordered_merge = false;
+            bool realtime = false;
+            bool reading = false; // registered as a latest-value reader
+            bool merging = false; // counted in the channel's ordered subscribers
+            typename MsgChannel<Msg>::filter_t filter;
+            unsigned int every_nth = 1;
+            Throttle::clock_type::duration min_interval = Throttle::clock_type::duration::zero();
     };
 
 
@@ -259,7 +1589,13 @@ namespace ITPS {
 
 // hash table storing messages with topic_name+msg_name as key
 template <class Msg>
-std::unordered_map<std::string, ITPS::MsgChannel<Msg>*> ITPS::MsgChannel<Msg>::msg_table;
+typename ITPS::MsgChannel<Msg>::msg_table_t ITPS::MsgChannel<Msg>::msg_table;
+
+template <class Msg>
+boost::shared_mutex ITPS::MsgChannel<Msg>::table_mutex;
+// prefix index over the keys of msg_table, for wildcard subscriptions
+template <class Msg>
+ITPS::TopicTrie ITPS::MsgChannel<Msg>::channel_index;
 
 template <class Msg>
-boost::shared_mutex ITPS::MsgChannel<Msg>::table_mutex;
\ No newline at end of file
+std::vector<typename ITPS::MsgChannel<Msg>::wildcard_sub_t> ITPS::MsgChannel<Msg>::wildcard_subs;
\ No newline at end of file
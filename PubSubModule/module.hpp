@@ -2,6 +2,8 @@
  
 #include <iostream>
 #include "inter_thread_pubsub.hpp"
+#include "synchronizer.hpp"
+#include "rolling_window.hpp"
 #include "oop_observer.hpp"
 #include "thread_pool.hpp"
 
@@ -14,13 +16,27 @@ class Module {
 
         }
 
-        virtual void task() = 0;
+        /* stop: set by request_stop(), a long running task should check it and return */
+        virtual void task(StopToken stop) = 0;
+
+        void request_stop() {
+            stop_source.request_stop();
+        }
+
+        // sleep & time of ITPS::Clock: virtual time once a VirtualClock is installed
+        static void delay(unsigned int milliseconds) {
+            ITPS::Clock::delay(milliseconds);
+        }
+
+        static unsigned int millis() {
+            return ITPS::Clock::millis();
+        }
         
         //======================Create New Thread Version=================================//
         /* create a new thread and run the module in that thread */
         void run() {
             mthread = boost::shared_ptr<boost::thread>(
-                new boost::thread(boost::bind(&Module::task, this))
+                new boost::thread(participate())
             );
         }
         /* don't use this method if the threadpool version of Module::run() was used */
@@ -38,13 +54,28 @@ class Module {
 
 
         //============================Thread Pool Version=================================//
-        /* run the module as a task to be queued for a thread pool*/
-        void run(ThreadPool& thread_pool) {
-            thread_pool.execute(boost::bind(&Module::task, this));
+        /* run the module as a task to be queued for a thread pool, the future gets ready
+         * once task() returned (and rethrows what it threw) */
+        std::future<void> run(ThreadPool& thread_pool) {
+            return thread_pool.execute(participate());
         }
         //================================================================================//
 
     private:
+        /* task() as a participant of the virtual clock if there's one, reserved right away so
+         * that virtual time doesn't move before the task starts */
+        boost::function<void()> participate() {
+            ITPS::VirtualClock *clock = ITPS::Clock::virtual_clock();
+            if(clock) clock->reserve();
+            return [this, clock]() {
+                ITPS::VirtualClock::Participant participant(clock);
+                // a pool worker runs other modules afterwards, task() may name the thread
+                ITPS::Tracer::ThreadNameScope thread_name;
+                task(stop_source.token());
+            };
+        }
+
         boost::shared_ptr<boost::thread> mthread;
+        StopSource stop_source;
 
 };
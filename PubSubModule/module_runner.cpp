@@ -1,4 +1,5 @@
 #include <iostream>
+#include <fstream>
 #include "thread_pool.hpp"
 #include "ModuleA.hpp"
 #include "ModuleB.hpp"
@@ -7,10 +8,6 @@
 
 
 
-static void delay(unsigned int milliseconds) {
-    boost::this_thread::sleep_for(boost::chrono::milliseconds(milliseconds));
-}
-
 int main(int arc, char *argv[]) {
 
 
@@ -29,17 +26,37 @@ int main(int arc, char *argv[]) {
 */
 
 /* thread pool version */
+    // module_runner.exe trace.json: record the msg flow, open it in chrome://tracing or ui.perfetto.dev
+    if(arc > 1) {
+        ITPS::Tracer::enable();
+    }
+
+    // run on virtual time: waits & timeouts jump ahead as soon as every module is blocked,
+    // Module_C's 50 pop timeouts take a few milliseconds (comment out install() for real time)
+    ITPS::VirtualClock virtual_clock;
+    ITPS::Clock::install(&virtual_clock);
+
     ThreadPool thread_pool(10); // pre-allocate 10 threads in a pool
 
     Module_A module_a;
     Module_B module_b;
     Module_C module_c;
 
-    module_a.run(thread_pool);
-    module_b.run(thread_pool);
-    module_c.run(thread_pool);
-
-    delay(8000); // wait 8 seconds until every thread is finished
+    std::vector<std::future<void>> done;
+    done.push_back(module_a.run(thread_pool));
+    done.push_back(module_b.run(thread_pool));
+    done.push_back(module_c.run(thread_pool));
+
+    thread_pool.drain(); // returns the moment every module is finished
+    for(auto& module_done: done) {
+        module_done.get(); // rethrows the exception of a module that failed
+    }
+
+    if(arc > 1) {
+        ITPS::Tracer::disable();
+        std::ofstream trace_file(argv[1]);
+        ITPS::Tracer::write_chrome_json(trace_file);
+    }
 
 
     return 0;
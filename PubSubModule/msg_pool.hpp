@@ -0,0 +1,233 @@
+/*
+ * Per-channel message object pool for ITPS topics carrying large payloads
+ */
+
+
+#pragma once
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+
+namespace ITPS {
+
+    /*
+     * Pooled Mode:
+     *  A topic declared with Msg = ITPS::Pooled<T>, i.e. Publisher<Pooled<T>> and
+     *  Subscriber<Pooled<T>>, carries reference-counted handles to T objects that live in
+     *  slots preallocated by the channel. The publisher borrows a slot with loan(), fills it
+     *  and publishes the handle; every copy pushed into a subscriber queue only bumps the
+     *  reference count, and the slot goes back to the pool when the last handle is dropped.
+     *
+     *  Slots are reserved when subscribers attach (by their queue capacity) and when publishers
+     *  join (by their history depth + 2), and released again when a subscriber's queue is
+     *  removed. The pool only allocates when the reservations exceed its capacity, so it stays
+     *  at the peak demand however often subscribers come and go, and in steady state
+     *  publish() / pop_msg() don't touch the heap. When the pool runs dry, loan() falls back to
+     *  a heap allocated slot rather than blocking the publisher, which is counted in
+     *  PoolStats::exhausted.
+     *
+     *  Slots are recycled without being reset, a std::vector payload keeps its capacity, so
+     *  refilling it doesn't allocate either. A published msg is shared by every subscriber,
+     *  it must not be modified after publish().
+     */
+
+    struct PoolStats {
+        size_t capacity = 0;  // number of preallocated slots
+        size_t reserved = 0;  // slots reserved by the current subscribers & publishers
+        size_t in_use = 0;    // preallocated slots currently loaned out
+        size_t exhausted = 0; // loans served from the heap because the pool was empty
+    };
+
+    template<class T>
+    class MsgPool;
+
+    namespace detail {
+
+        template<class T>
+        struct PoolCore;
+
+        template<class T>
+        struct PoolSlot {
+            T value;
+            std::atomic<long> refs{0};
+            PoolCore<T> *core = nullptr; // nullptr for heap fallback slots
+        };
+
+        /* The storage of a pool. It is kept alive by the channel's MsgPool plus one reference
+         * per loaned slot, since handles may outlive the channel (e.g. sitting in a queue) */
+        template<class T>
+        struct PoolCore {
+            boost::mutex mu;
+            std::vector<std::unique_ptr<PoolSlot<T>[]>> chunks;
+            std::vector<PoolSlot<T>*> free_slots; // capacity == total number of slots, never reallocates on release
+            size_t capacity = 0;
+            size_t reserved = 0;
+            size_t exhausted = 0;
+            std::atomic<long> refs{1};
+
+            void unref() {
+                if(--refs == 0) delete this;
+            }
+
+            void release(PoolSlot<T> *slot) {
+                {
+                    boost::lock_guard<boost::mutex> guard(mu);
+                    free_slots.push_back(slot);
+                }
+                unref();
+            }
+        };
+
+    }
+
+
+    /* Reference-counted handle to a pooled T, copying it never allocates */
+    template<class T>
+    class Pooled {
+        public:
+            Pooled() {}
+
+            Pooled(const Pooled& other) : slot(other.slot) {
+                if(slot) slot->refs++;
+            }
+
+            Pooled(Pooled&& other) : slot(other.slot) {
+                other.slot = nullptr;
+            }
+
+            Pooled& operator=(const Pooled& other) {
+                if(other.slot) other.slot->refs++;
+                release();
+                slot = other.slot;
+                return *this;
+            }
+
+            Pooled& operator=(Pooled&& other) {
+                if(this != &other) {
+                    release();
+                    slot = other.slot;
+                    other.slot = nullptr;
+                }
+                return *this;
+            }
+
+            ~Pooled() {
+                release();
+            }
+
+            T& operator*() const { return slot->value; }
+            T* operator->() const { return &slot->value; }
+            T* get() const { return slot ? &slot->value : nullptr; }
+            explicit operator bool() const { return slot != nullptr; }
+
+        private:
+            friend class MsgPool<T>;
+
+            explicit Pooled(detail::PoolSlot<T> *slot) : slot(slot) {
+                slot->refs = 1;
+            }
+
+            void release() {
+                if(slot == nullptr) return;
+                if(--slot->refs == 0) {
+                    if(slot->core) {
+                        slot->core->release(slot);
+                    }
+                    else {
+                        delete slot;
+                    }
+                }
+                slot = nullptr;
+            }
+
+            detail::PoolSlot<T> *slot = nullptr;
+    };
+
+
+    /* The pool of a single channel */
+    template<class T>
+    class MsgPool {
+        public:
+            MsgPool() : core(new detail::PoolCore<T>()) {}
+            MsgPool(const MsgPool&) = delete;
+            MsgPool& operator=(const MsgPool&) = delete;
+
+            ~MsgPool() {
+                core->unref();
+            }
+
+            /* reserve num_slots more slots, preallocating the ones beyond the capacity.
+             * Called on subscribe / publisher join, never on the publish path */
+            void reserve(size_t num_slots) {
+                if(num_slots == 0) return;
+                boost::lock_guard<boost::mutex> guard(core->mu);
+                core->reserved += num_slots;
+                if(core->reserved <= core->capacity) return;
+                size_t missing = core->reserved - core->capacity;
+                std::unique_ptr<detail::PoolSlot<T>[]> chunk(new detail::PoolSlot<T>[missing]);
+                core->free_slots.reserve(core->reserved);
+                for(size_t i = 0; i < missing; i++) {
+                    chunk[i].core = core;
+                    core->free_slots.push_back(&chunk[i]);
+                }
+                core->chunks.push_back(std::move(chunk));
+                core->capacity = core->reserved;
+            }
+
+            /* give back slots reserved by a subscriber that left, they're kept preallocated
+             * for the next reservation */
+            void release(size_t num_slots) {
+                boost::lock_guard<boost::mutex> guard(core->mu);
+                core->reserved -= std::min(num_slots, core->reserved);
+            }
+
+            Pooled<T> loan() {
+                {
+                    boost::lock_guard<boost::mutex> guard(core->mu);
+                    if(!core->free_slots.empty()) {
+                        detail::PoolSlot<T> *slot = core->free_slots.back();
+                        core->free_slots.pop_back();
+                        core->refs++;
+                        return Pooled<T>(slot);
+                    }
+                    core->exhausted++;
+                }
+                return Pooled<T>(new detail::PoolSlot<T>());
+            }
+
+            PoolStats stats() {
+                boost::lock_guard<boost::mutex> guard(core->mu);
+                PoolStats stats;
+                stats.capacity = core->capacity;
+                stats.reserved = core->reserved;
+                stats.in_use = core->capacity - core->free_slots.size();
+                stats.exhausted = core->exhausted;
+                return stats;
+            }
+
+        private:
+            detail::PoolCore<T> *core;
+    };
+
+
+    /* MsgChannel<Msg> owns a pool only when Msg is a Pooled<T> */
+    struct NoPool {
+        void reserve(size_t) {}
+        void release(size_t) {}
+    };
+
+    template<class Msg>
+    struct msg_pool_traits {
+        typedef NoPool pool_type;
+    };
+
+    template<class T>
+    struct msg_pool_traits<Pooled<T>> {
+        typedef MsgPool<T> pool_type;
+    };
+
+}
@@ -0,0 +1,437 @@
+/*
+ * Declarative pipeline graph on top of ITPS topics, fusing single-consumer chains into direct calls
+ */
+
+
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <sstream>
+#include <typeindex>
+#include <boost/thread/thread.hpp>
+
+#include "inter_thread_pubsub.hpp"
+
+
+namespace ITPS {
+
+    /*
+     * A Pipeline declares stages and the topics connecting them:
+     *  * source<Out>(name, out_topic, generate):     bool generate(Out& msg), false ends the source
+     *  * stage<In, Out>(name, in_topic, out_topic, f): Out f(const In& msg)
+     *  * sink<In>(name, in_topic, f):                  void f(const In& msg)
+     * Topic names are ITPS msg names on the Default_Topic, so inputs with no producer in the
+     * pipeline subscribe to regular publishers (e.g. Publisher<double>("sensorA data")).
+     *
+     * On start(), every edge is either:
+     *  * fused: the topic has a single producer and a single consumer in the pipeline and the
+     *    consumer doesn't ask for its own thread, the producer then calls the consumer directly
+     *    on its own thread, no queue, no wakeup, no copy into the ITPS channel.
+     *  * queued: on fan-out (several consumers), merge (several producers), or when the consumer
+     *    asks for it with queued() (e.g. a rate mismatch, the producer shouldn't wait for a slow
+     *    consumer) or parallel() (several worker threads popping the same queue, out of order).
+     *    The producer publishes through an ITPS Publisher, the consumer pops its own queue.
+     * Topics with no consumer in the pipeline are published, so code outside can subscribe.
+     * A fused consumer runs on its producer's thread(s), so a chain of fused stages forms a
+     * segment run by one thread (or by the workers of its head stage).
+     *
+     * to_dot() exports the resulting graph in Graphviz format.
+     */
+
+    template<class In>
+    class PipelineInput {
+        public:
+            virtual ~PipelineInput() {}
+            virtual void process(const In& msg) = 0;
+
+        protected:
+            void open_queue(std::string topic, unsigned int queue_size) {
+                // make sure the channel exists for the duration of subscribe(), even with no publisher yet
+                boost::shared_ptr<MsgChannel<In>> channel = MsgChannel<In>::create(Default_Topic, topic);
+                subscriber = boost::shared_ptr<Subscriber<In>>(new Subscriber<In>(topic, queue_size));
+                subscriber->subscribe();
+            }
+
+            void run_queue() {
+                In msg;
+                while(subscriber->wait_msg(msg)) {
+                    process(msg);
+                }
+            }
+
+            void close_queue() {
+                if(subscriber) subscriber->unsubscribe();
+            }
+
+            boost::shared_ptr<Subscriber<In>> subscriber;
+    };
+
+
+    class PipelineStage {
+        public:
+            virtual ~PipelineStage() {}
+
+            // give this stage its own input queue & thread
+            PipelineStage& queued(unsigned int queue_size) {
+                this->queue_size = queue_size;
+                decoupled = true;
+                return *this;
+            }
+
+            // have num_workers threads pop this stage's input queue, msgs get processed out of order
+            PipelineStage& parallel(unsigned int num_workers, unsigned int queue_size) {
+                this->num_workers = std::max(num_workers, 1u);
+                return queued(queue_size);
+            }
+
+            const std::string& get_name() const {
+                return name;
+            }
+
+        protected:
+            friend class Pipeline;
+
+            PipelineStage(std::string name, std::string in_topic, std::string out_topic,
+                          std::type_index in_type, std::type_index out_type)
+                : name(name), in_topic(in_topic), out_topic(out_topic), in_type(in_type), out_type(out_type) {}
+
+            bool has_input() const { return !in_topic.empty(); }
+            bool has_output() const { return !out_topic.empty(); }
+
+            /* wiring, called by Pipeline::start() */
+            // call consumer.process() on every output msg, the types are checked by the pipeline
+            virtual void fuse(PipelineStage&) {}
+            // publish the output msgs to out_topic
+            virtual void open_output() {}
+            virtual void open_input(unsigned int) {}
+            // thread body of a source, or of a stage with an input queue
+            virtual void run() = 0;
+            virtual void stop() {}
+
+            std::string name, in_topic, out_topic;
+            std::type_index in_type, out_type;
+            unsigned int num_workers = 1;
+            unsigned int queue_size = 0;
+            bool decoupled = false;
+
+            // filled in by Pipeline::plan()
+            PipelineStage *fused_into = nullptr; // the producer calling this stage directly
+            bool publishes = false;
+
+            boost::thread_group threads; // none for a fused stage
+    };
+
+
+    template<class Out>
+    class PipelineOutput : public PipelineStage {
+        protected:
+            using PipelineStage::PipelineStage;
+
+            void emit(const Out& msg) {
+                for(auto consumer: fused) {
+                    consumer->process(msg);
+                }
+                if(publisher) {
+                    publisher->publish(msg);
+                }
+            }
+
+            void fuse(PipelineStage& consumer) override {
+                fused.push_back(dynamic_cast<PipelineInput<Out>*>(&consumer));
+            }
+
+            void open_output() override {
+                publisher = boost::shared_ptr<Publisher<Out>>(new Publisher<Out>(out_topic));
+            }
+
+            std::vector<PipelineInput<Out>*> fused;
+            boost::shared_ptr<Publisher<Out>> publisher;
+    };
+
+
+    template<class Out>
+    class SourceStage : public PipelineOutput<Out> {
+        public:
+            SourceStage(std::string name, std::string out_topic, boost::function<bool(Out&)> generate)
+                : PipelineOutput<Out>(name, "", out_topic, typeid(void), typeid(Out)), generate(generate) {}
+
+        protected:
+            void run() override {
+                Out msg;
+                while(!stopped && generate(msg)) {
+                    this->emit(msg);
+                }
+            }
+
+            void stop() override {
+                stopped = true;
+            }
+
+            boost::function<bool(Out&)> generate;
+            std::atomic<bool> stopped{false};
+    };
+
+
+    template<class In, class Out>
+    class TransformStage : public PipelineOutput<Out>, public PipelineInput<In> {
+        public:
+            TransformStage(std::string name, std::string in_topic, std::string out_topic, boost::function<Out(const In&)> transform)
+                : PipelineOutput<Out>(name, in_topic, out_topic, typeid(In), typeid(Out)), transform(transform) {}
+
+            void process(const In& msg) override {
+                this->emit(transform(msg));
+            }
+
+        protected:
+            void open_input(unsigned int queue_size) override { this->open_queue(this->in_topic, queue_size); }
+            void run() override { this->run_queue(); }
+            void stop() override { this->close_queue(); }
+
+            boost::function<Out(const In&)> transform;
+    };
+
+
+    template<class In>
+    class SinkStage : public PipelineStage, public PipelineInput<In> {
+        public:
+            SinkStage(std::string name, std::string in_topic, boost::function<void(const In&)> consume)
+                : PipelineStage(name, in_topic, "", typeid(In), typeid(void)), consume(consume) {}
+
+            void process(const In& msg) override {
+                consume(msg);
+            }
+
+        protected:
+            void open_input(unsigned int queue_size) override { this->open_queue(in_topic, queue_size); }
+            void run() override { this->run_queue(); }
+            void stop() override { this->close_queue(); }
+
+            boost::function<void(const In&)> consume;
+    };
+
+
+    class Pipeline {
+        public:
+            // default_queue_size: size of the queues inserted on fan-out / merge / external inputs
+            Pipeline(unsigned int default_queue_size = 100) : default_queue_size(default_queue_size) {}
+
+            Pipeline(const Pipeline&) = delete;
+            Pipeline& operator=(const Pipeline&) = delete;
+
+            ~Pipeline() {
+                stop();
+            }
+
+            template<class Out>
+            PipelineStage& source(std::string name, std::string out_topic, boost::function<bool(Out&)> generate) {
+                return add(new SourceStage<Out>(name, out_topic, generate));
+            }
+
+            template<class In, class Out>
+            PipelineStage& stage(std::string name, std::string in_topic, std::string out_topic, boost::function<Out(const In&)> transform) {
+                return add(new TransformStage<In, Out>(name, in_topic, out_topic, transform));
+            }
+
+            template<class In>
+            PipelineStage& sink(std::string name, std::string in_topic, boost::function<void(const In&)> consume) {
+                return add(new SinkStage<In>(name, in_topic, consume));
+            }
+
+            /* wire the graph and start the threads, return false (and start nothing) if a topic
+             * is produced & consumed with different msg types */
+            bool start() {
+                if(running || !plan()) {
+                    return false;
+                }
+                running = true;
+
+                // publishers first, so that the queued consumers find their channels
+                for(auto& stage: stages) {
+                    if(stage->publishes) stage->open_output();
+                }
+                for(auto& stage: stages) {
+                    if(stage->has_input() && stage->fused_into == nullptr) {
+                        stage->open_input(stage->decoupled ? stage->queue_size : default_queue_size);
+                    }
+                }
+                for(auto& stage: stages) {
+                    if(stage->fused_into != nullptr) stage->fused_into->fuse(*stage);
+                }
+
+                for(auto& stage: stages) {
+                    if(stage->fused_into != nullptr) continue;
+                    unsigned int num_threads = stage->has_input() ? stage->num_workers : 1;
+                    for(unsigned int i = 0; i < num_threads; i++) {
+                        stage->threads.create_thread(boost::bind(&PipelineStage::run, stage.get()));
+                    }
+                }
+                return true;
+            }
+
+            /* stop the sources, then close the queues (queued msgs are still processed) and
+             * join every thread, upstream stages first */
+            void stop() {
+                if(!running) return;
+                for(auto& stage: stages) {
+                    if(!stage->has_input()) stage->stop();
+                }
+                shut_down();
+            }
+
+            /* wait until the sources end on their own (generate() returned false), then shut
+             * down like stop() once their msgs went through the whole pipeline */
+            void wait() {
+                if(!running) return;
+                shut_down();
+            }
+
+            // Graphviz export of the planned graph, plan on the fly if not started yet
+            std::string to_dot() {
+                if(!running) plan();
+
+                std::stringstream ss;
+                ss << "digraph pipeline {" << std::endl;
+                ss << "    rankdir=LR;" << std::endl;
+                for(auto& stage: stages) {
+                    ss << "    \"" << stage->name << "\"";
+                    if(stage->num_workers > 1) ss << " [label=\"" << stage->name << " x" << stage->num_workers << "\"]";
+                    ss << ";" << std::endl;
+                }
+
+                std::map<std::string, topic_t> topics = collect_topics();
+                for(auto& topic: topics) {
+                    std::string topic_node = "\"topic: " + topic.first + "\"";
+                    bool external_node = topic.second.producers.empty() || topic.second.consumers.empty();
+                    if(external_node) {
+                        ss << "    " << topic_node << " [shape=box];" << std::endl;
+                    }
+                    for(auto consumer: topic.second.consumers) {
+                        std::string edge = consumer->fused_into != nullptr ? "fused" :
+                            "queue " + std::to_string(consumer->decoupled ? consumer->queue_size : default_queue_size);
+                        std::string label = " [label=\"" + topic.first + " (" + edge + ")\"];";
+                        if(topic.second.producers.empty()) {
+                            ss << "    " << topic_node << " -> \"" << consumer->name << "\"" << label << std::endl;
+                        }
+                        for(auto producer: topic.second.producers) {
+                            ss << "    \"" << producer->name << "\" -> \"" << consumer->name << "\"" << label << std::endl;
+                        }
+                    }
+                    if(topic.second.consumers.empty()) {
+                        for(auto producer: topic.second.producers) {
+                            ss << "    \"" << producer->name << "\" -> " << topic_node
+                               << " [label=\"" << topic.first << " (published)\"];" << std::endl;
+                        }
+                    }
+                }
+                ss << "}" << std::endl;
+                return ss.str();
+            }
+
+
+        protected:
+            struct topic_t {
+                std::vector<PipelineStage*> producers, consumers;
+            };
+
+            PipelineStage& add(PipelineStage *stage) {
+                stages.push_back(boost::shared_ptr<PipelineStage>(stage));
+                return *stage;
+            }
+
+            std::map<std::string, topic_t> collect_topics() {
+                std::map<std::string, topic_t> topics;
+                for(auto& stage: stages) {
+                    if(stage->has_output()) topics[stage->out_topic].producers.push_back(stage.get());
+                    if(stage->has_input()) topics[stage->in_topic].consumers.push_back(stage.get());
+                }
+                return topics;
+            }
+
+            // decide which edges get fused, false on msg type mismatch
+            bool plan() {
+                std::map<std::string, topic_t> topics = collect_topics();
+                for(auto& topic: topics) {
+                    for(auto producer: topic.second.producers) {
+                        for(auto consumer: topic.second.consumers) {
+                            if(producer->out_type != consumer->in_type) return false;
+                        }
+                    }
+                }
+
+                for(auto& stage: stages) {
+                    stage->fused_into = nullptr;
+                    stage->publishes = false;
+                }
+                for(auto& topic: topics) {
+                    auto& producers = topic.second.producers;
+                    auto& consumers = topic.second.consumers;
+                    if(producers.size() == 1 && consumers.size() == 1 && !consumers[0]->decoupled
+                       && !creates_cycle(producers[0], consumers[0])) {
+                        consumers[0]->fused_into = producers[0];
+                    }
+                    else {
+                        for(auto producer: producers) producer->publishes = true;
+                    }
+                }
+                return true;
+            }
+
+            /* Join the sources, then close the input of every threaded stage & join its threads
+             * once all of its producers are done, so no stage publishes into a closed queue.
+             * A fused stage is done along with the thread running its segment. */
+            void shut_down() {
+                std::set<PipelineStage*> done;
+                std::vector<PipelineStage*> pending;
+                for(auto& stage: stages) {
+                    if(stage->fused_into != nullptr) continue;
+                    if(!stage->has_input()) {
+                        stage->threads.join_all();
+                        done.insert(stage.get());
+                    }
+                    else {
+                        pending.push_back(stage.get());
+                    }
+                }
+
+                std::map<std::string, topic_t> topics = collect_topics();
+                while(!pending.empty()) {
+                    auto ready = std::find_if(pending.begin(), pending.end(), [&](PipelineStage *stage) {
+                        for(auto producer: topics[stage->in_topic].producers) {
+                            if(done.count(segment_head(producer)) == 0) return false;
+                        }
+                        return true;
+                    });
+                    // none ready: the queued stages form a cycle, break it at the first one
+                    if(ready == pending.end()) ready = pending.begin();
+                    PipelineStage *stage = *ready;
+                    pending.erase(ready);
+                    stage->stop();
+                    stage->threads.join_all();
+                    done.insert(stage);
+                }
+                running = false;
+            }
+
+            // the stage whose thread runs stage
+            static PipelineStage* segment_head(PipelineStage *stage) {
+                while(stage->fused_into != nullptr) stage = stage->fused_into;
+                return stage;
+            }
+
+            // fusing a cycle would recurse forever on a single thread
+            bool creates_cycle(PipelineStage *producer, PipelineStage *consumer) {
+                for(PipelineStage *stage = producer; stage != nullptr; stage = stage->fused_into) {
+                    if(stage == consumer) return true;
+                }
+                return false;
+            }
+
+            std::vector<boost::shared_ptr<PipelineStage>> stages;
+            unsigned int default_queue_size;
+            bool running = false;
+    };
+
+}
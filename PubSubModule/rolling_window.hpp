@@ -0,0 +1,332 @@
+/*
+ * Windowed aggregation of numeric topics: rolling mean, variance, min/max & percentiles
+ */
+
+
+#pragma once
+#include <vector>
+#include <array>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include "inter_thread_pubsub.hpp"
+
+#if !defined(ITPS_NO_SIMD) && __has_include(<experimental/simd>)
+#include <experimental/simd>
+#define ITPS_WINDOW_SIMD 1
+#endif
+
+
+namespace ITPS {
+
+    struct WindowStats {
+        size_t count = 0;
+        double mean = 0, variance = 0; // population variance
+        double min = 0, max = 0;
+    };
+
+    /*
+     * The last capacity samples (optionally only those younger than max_age_ms, of ITPS::Clock)
+     * in a ring that is always readable as one contiguous array: every sample is stored twice,
+     * at i and i + capacity, so the window [head, head + size) never wraps. view() hands out
+     * that array without copying, oldest sample first.
+     *
+     * mean & variance are maintained incrementally (sums shifted by a reference value, so
+     * large offsets don't cancel out), and re-summed over the window every capacity evictions
+     * to bound the rounding drift. min / max scan the window with a vectorized kernel
+     * (std::experimental::simd, native width of the target e.g. AVX2 / NEON when enabled at
+     * compile time, scalar loop otherwise or with ITPS_NO_SIMD). percentile() partially sorts
+     * a preallocated copy. Nothing allocates after construction.
+     *
+     * Not thread-safe, meant to be owned by one consumer thread (check WindowedSubscriber).
+     */
+    class RollingWindow {
+        public:
+            struct view_t {
+                const double *data;
+                size_t size;
+                const double* begin() const { return data; }
+                const double* end() const { return data + size; }
+                double operator[](size_t i) const { return data[i]; }
+            };
+
+            RollingWindow(size_t capacity, unsigned int max_age_ms = 0)
+                : capacity(std::max<size_t>(capacity, 1)), values(2 * this->capacity), scratch(this->capacity),
+                  max_age(boost::chrono::milliseconds(max_age_ms)) {
+                if(max_age_ms > 0) stamps.resize(this->capacity);
+            }
+
+            void add(double sample) {
+                add(sample, Clock::now());
+            }
+
+            void add(double sample, Clock::time_point stamp) {
+                if(count == capacity) {
+                    evict();
+                }
+                if(count == 0) {
+                    shift = sample;
+                }
+                size_t pos = (head + count) % capacity;
+                values[pos] = values[pos + capacity] = sample;
+                if(!stamps.empty()) stamps[pos] = stamp;
+                count++;
+                sum += sample - shift;
+                sum_sq += (sample - shift) * (sample - shift);
+                expire(stamp);
+            }
+
+            // drop the samples older than max_age_ms
+            void expire(Clock::time_point now = Clock::now()) {
+                if(stamps.empty()) return;
+                while(count > 0 && stamps[head] + max_age <= now) {
+                    evict();
+                }
+            }
+
+            void clear() {
+                head = count = 0;
+                sum = sum_sq = 0;
+                num_evicted = 0;
+            }
+
+            // valid until the next add() / expire()
+            view_t view() const {
+                return {values.data() + head, count};
+            }
+
+            size_t size() const {
+                return count;
+            }
+
+            WindowStats stats() const {
+                WindowStats stats;
+                stats.count = count;
+                if(count == 0) return stats;
+                double mean_shifted = sum / count;
+                stats.mean = shift + mean_shifted;
+                stats.variance = std::max(0.0, sum_sq / count - mean_shifted * mean_shifted);
+                min_max(values.data() + head, count, stats.min, stats.max);
+                return stats;
+            }
+
+            /* p in [0, 1], linear interpolation between the closest ranks, 0 on an empty window */
+            double percentile(double p) {
+                if(count == 0) return 0;
+                std::copy(values.begin() + head, values.begin() + head + count, scratch.begin());
+                double rank = std::min(std::max(p, 0.0), 1.0) * (count - 1);
+                size_t lower = (size_t) rank;
+                auto end = scratch.begin() + count;
+                std::nth_element(scratch.begin(), scratch.begin() + lower, end);
+                double value = scratch[lower];
+                if(lower + 1 < count) {
+                    // the next rank is the smallest of the upper partition
+                    double next = *std::min_element(scratch.begin() + lower + 1, end);
+                    value += (rank - lower) * (next - value);
+                }
+                return value;
+            }
+
+        private:
+            void evict() {
+                double oldest = values[head] - shift;
+                sum -= oldest;
+                sum_sq -= oldest * oldest;
+                head = (head + 1) % capacity;
+                count--;
+                if(count == 0) {
+                    // no rounding residue carried over to the next samples
+                    sum = sum_sq = 0;
+                    num_evicted = 0;
+                    return;
+                }
+                if(++num_evicted >= capacity) {
+                    resum();
+                }
+            }
+
+            // exact sums over the window, re-centered on its mean
+            void resum() {
+                num_evicted = 0;
+                if(count == 0) {
+                    sum = sum_sq = 0;
+                    return;
+                }
+                shift += sum / count;
+                sums(values.data() + head, count, shift, sum, sum_sq);
+            }
+
+#ifdef ITPS_WINDOW_SIMD
+            typedef std::experimental::native_simd<double> vec_t;
+
+            static void min_max(const double *data, size_t n, double& lo, double& hi) {
+                const size_t width = vec_t::size();
+                vec_t vlo(std::numeric_limits<double>::infinity()), vhi(-std::numeric_limits<double>::infinity());
+                size_t i = 0;
+                for(; i + width <= n; i += width) {
+                    vec_t x(data + i, std::experimental::element_aligned);
+                    vlo = std::experimental::min(vlo, x);
+                    vhi = std::experimental::max(vhi, x);
+                }
+                lo = std::experimental::hmin(vlo);
+                hi = std::experimental::hmax(vhi);
+                for(; i < n; i++) {
+                    lo = std::min(lo, data[i]);
+                    hi = std::max(hi, data[i]);
+                }
+            }
+
+            static void sums(const double *data, size_t n, double shift, double& sum, double& sum_sq) {
+                const size_t width = vec_t::size();
+                vec_t vsum(0.0), vsq(0.0), vshift(shift);
+                size_t i = 0;
+                for(; i + width <= n; i += width) {
+                    vec_t x = vec_t(data + i, std::experimental::element_aligned) - vshift;
+                    vsum += x;
+                    vsq += x * x;
+                }
+                sum = std::experimental::reduce(vsum);
+                sum_sq = std::experimental::reduce(vsq);
+                for(; i < n; i++) {
+                    sum += data[i] - shift;
+                    sum_sq += (data[i] - shift) * (data[i] - shift);
+                }
+            }
+#else
+            static void min_max(const double *data, size_t n, double& lo, double& hi) {
+                lo = std::numeric_limits<double>::infinity();
+                hi = -std::numeric_limits<double>::infinity();
+                for(size_t i = 0; i < n; i++) {
+                    lo = std::min(lo, data[i]);
+                    hi = std::max(hi, data[i]);
+                }
+            }
+
+            static void sums(const double *data, size_t n, double shift, double& sum, double& sum_sq) {
+                sum = sum_sq = 0;
+                for(size_t i = 0; i < n; i++) {
+                    sum += data[i] - shift;
+                    sum_sq += (data[i] - shift) * (data[i] - shift);
+                }
+            }
+#endif
+
+            size_t capacity;
+            std::vector<double> values; // 2 * capacity, mirrored halves
+            std::vector<double> scratch; // for percentile()
+            std::vector<Clock::time_point> stamps; // only with a max age
+            Clock::duration max_age;
+            size_t head = 0, count = 0;
+            double shift = 0, sum = 0, sum_sq = 0; // sums of (sample - shift)
+            size_t num_evicted = 0;
+    };
+
+
+    /* What a WindowedSubscriber windows in a msg: an arithmetic msg is one sample, a
+     * std::array<T, N> of arithmetic T gives one sample per element, each with its own window */
+    template<class Msg>
+    struct window_traits {
+        static constexpr bool value = std::is_arithmetic<Msg>::value;
+        static constexpr size_t elements = 1;
+        static double sample(const Msg& msg, size_t) { return msg; }
+    };
+
+    template<class T, size_t N>
+    struct window_traits<std::array<T, N>> {
+        static constexpr bool value = std::is_arithmetic<T>::value && N > 0;
+        static constexpr size_t elements = N;
+        static double sample(const std::array<T, N>& msg, size_t element) { return msg[element]; }
+    };
+
+
+    /*
+     * Queue subscriber of a numeric topic (arithmetic msg type, or a std::array of them with
+     * one window per element) feeding RollingWindows: update() drains the msgs received so far
+     * into the windows, on the consumer's thread, then the statistics & the views of the
+     * windows are read without any locking. The element argument picks the array element
+     * (0 for a scalar topic).
+     * The queue holds window_size msgs by default, msgs beyond that block the publisher
+     * until the next update() (or get dropped with a non-blocking OverflowPolicy).
+     */
+    template<class T>
+    class WindowedSubscriber : public Subscriber<T> {
+        public:
+            typedef typename Subscriber<T>::Msg Msg;
+            typedef window_traits<Msg> traits;
+            static_assert(traits::value, "WindowedSubscriber needs a numeric msg type, or a std::array of one");
+
+            WindowedSubscriber(std::string topic_name, std::string msg_name, size_t window_size,
+                               unsigned int max_age_ms = 0, unsigned int queue_size = 0)
+                : Subscriber<T>(topic_name, msg_name, queue_size ? queue_size : window_size) {
+                make_windows(window_size, max_age_ms);
+            }
+
+            WindowedSubscriber(std::string msg_name, size_t window_size, unsigned int max_age_ms = 0, unsigned int queue_size = 0)
+                : WindowedSubscriber(Default_Topic, msg_name, window_size, max_age_ms, queue_size) {}
+
+            // for descriptors declared with ITPS_TOPIC
+            WindowedSubscriber(size_t window_size, unsigned int max_age_ms = 0, unsigned int queue_size = 0)
+                : Subscriber<T>(queue_size ? queue_size : window_size) {
+                make_windows(window_size, max_age_ms);
+            }
+
+            // move the pending msgs into the windows, return how many
+            size_t update() {
+                Msg msg;
+                size_t num_msgs = 0;
+                while(this->try_pop_msg(msg)) {
+                    add(msg);
+                    num_msgs++;
+                }
+                Clock::time_point now = Clock::now();
+                for(auto& rolling: windows) {
+                    rolling.expire(now);
+                }
+                return num_msgs;
+            }
+
+            // block until at least one msg arrived, then update()
+            size_t wait_update() {
+                add(this->pop_msg());
+                return 1 + update();
+            }
+
+            // 1 for a scalar topic, N for std::array<T, N>
+            static constexpr size_t elements() {
+                return traits::elements;
+            }
+
+            WindowStats stats(size_t element = 0) const {
+                return windows[element].stats();
+            }
+
+            double percentile(double p, size_t element = 0) {
+                return windows[element].percentile(p);
+            }
+
+            RollingWindow::view_t window(size_t element = 0) const {
+                return windows[element].view();
+            }
+
+        private:
+            void make_windows(size_t window_size, unsigned int max_age_ms) {
+                windows.reserve(traits::elements);
+                for(size_t i = 0; i < traits::elements; i++) {
+                    windows.emplace_back(window_size, max_age_ms);
+                }
+            }
+
+            // the elements of a msg share one stamp
+            void add(const Msg& msg) {
+                Clock::time_point now = Clock::now();
+                for(size_t i = 0; i < traits::elements; i++) {
+                    windows[i].add(traits::sample(msg, i), now);
+                }
+            }
+
+            std::vector<RollingWindow> windows; // one per element
+    };
+
+}
@@ -0,0 +1,265 @@
+/*
+ * Request / response (RPC) over ITPS channels, replies routed to the caller by correlation id
+ */
+
+
+#pragma once
+#include <string>
+#include <future>
+#include <chrono>
+#include <stdexcept>
+#include <exception>
+#include <unordered_map>
+#include <boost/function.hpp>
+
+#include "inter_thread_pubsub.hpp"
+
+
+namespace ITPS {
+
+    /*
+     * A Client<Req, Resp> publishes each call as an RpcRequest on the channel "topic.service"
+     * (a channel of RpcRequest<Req, Resp>, distinct from a plain Req channel of the same key),
+     * numbered with a correlation id and carrying a weak reference to the client's ReplyBox.
+     * The Service<Req, Resp> of that key handles it and completes the caller's pending call
+     * by its id directly: one handoff per call, the reply is never broadcast and no one polls.
+     *
+     * A Service runs its handler either inline, on the calling thread within Client::call(),
+     * or on an executor such as a ThreadPool (anything with execute(boost::function<void()>)),
+     * then calls of several clients are served concurrently. Requests of a client that is gone
+     * or gave up waiting are skipped without running the handler.
+     *
+     * One Service per key: constructing a second one on a served key throws RpcError.
+     */
+
+    /* a call that couldn't be served: no service, or its deadline passed before it ran.
+     * Also thrown by a Service constructed on a key that is already served */
+    class RpcError : public std::runtime_error {
+        public:
+            RpcError(const std::string& what) : std::runtime_error(what) {}
+    };
+
+    typedef unsigned long long correlation_id_t;
+
+    /* The pending calls of one Client, each one a promise completed by a Service */
+    template<class Resp>
+    class ReplyBox {
+        public:
+            std::future<Resp> open(correlation_id_t id) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                return pending[id].get_future();
+            }
+
+            // false if the call is gone (answered, or abandoned after a timeout)
+            bool is_open(correlation_id_t id) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                return pending.count(id) > 0;
+            }
+
+            bool reply(correlation_id_t id, Resp response) {
+                std::promise<Resp> promise;
+                if(!take(id, promise)) return false;
+                promise.set_value(std::move(response));
+                notify();
+                return true;
+            }
+
+            bool fail(correlation_id_t id, std::exception_ptr error) {
+                std::promise<Resp> promise;
+                if(!take(id, promise)) return false;
+                promise.set_exception(error);
+                notify();
+                return true;
+            }
+
+            /* block on ITPS::Clock until the call of id is completed or deadline passed, on
+             * timeout the call is abandoned, a late reply gets dropped */
+            bool wait(correlation_id_t id, std::future<Resp>& reply, Clock::time_point deadline) {
+                auto ready = [&reply]() {
+                    return reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+                };
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if(deadline == Clock::time_point::max()) {
+                    while(!ready()) {
+                        replied.wait(lock);
+                    }
+                    return true;
+                }
+                if(replied.wait_until(lock, deadline, ready)) return true;
+                if(pending.erase(id) > 0) return false;
+                // taken by a service right at the deadline, the reply is on its way
+                while(!ready()) {
+                    replied.wait(lock);
+                }
+                return true;
+            }
+
+        private:
+            bool take(correlation_id_t id, std::promise<Resp>& promise) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                auto call = pending.find(id);
+                if(call == pending.end()) return false;
+                promise = std::move(call->second);
+                pending.erase(call);
+                return true;
+            }
+
+            void notify() {
+                // taking the mutex orders this with a waiter between its check & its wait
+                { boost::lock_guard<boost::mutex> guard(mutex); }
+                replied.notify_all();
+            }
+
+            boost::mutex mutex;
+            ClockCondition replied;
+            std::unordered_map<correlation_id_t, std::promise<Resp>> pending;
+    };
+
+    template<class Req, class Resp>
+    struct RpcRequest {
+        correlation_id_t id;
+        Req request;
+        boost::weak_ptr<ReplyBox<Resp>> reply_to;
+        Clock::time_point deadline; // time_point::max() without a timeout
+    };
+
+
+    template<class Req, class Resp>
+    class Service {
+        public:
+            typedef RpcRequest<Req, Resp> request_t;
+            typedef boost::function<Resp(const Req&)> handler_t;
+
+            /* inline: the handler runs on the caller's thread, the call's future is ready
+             * when Client::call() returns */
+            Service(std::string topic_name, std::string service_name, handler_t handler)
+                : Service(topic_name, service_name, handler, dispatch_t()) {}
+
+            Service(std::string service_name, handler_t handler) : Service(Default_Topic, service_name, handler) {}
+
+            /* each request is handed to executor.execute() (e.g. a ThreadPool). The executor
+             * is held by reference: it must outlive the service, and must not be destroyed
+             * while a client may still be calling. Use the shared_ptr version otherwise */
+            template<class Executor>
+            Service(std::string topic_name, std::string service_name, handler_t handler, Executor& executor)
+                : Service(topic_name, service_name, handler, dispatch_t([&executor](boost::function<void()> job) {
+                      executor.execute(job);
+                  })) {}
+
+            // the service shares the ownership of the executor, which lives as long as needed
+            template<class Executor>
+            Service(std::string topic_name, std::string service_name, handler_t handler, boost::shared_ptr<Executor> executor)
+                : Service(topic_name, service_name, handler, dispatch_t([executor](boost::function<void()> job) {
+                      executor->execute(job);
+                  })) {}
+
+            Service(const Service&) = delete;
+            Service& operator=(const Service&) = delete;
+
+            /* once this returns no handler is invoked inline anymore, requests already handed
+             * to the executor still run */
+            ~Service() {
+                channel->remove_slots(id);
+            }
+
+        private:
+            typedef boost::function<void(boost::function<void()>)> dispatch_t;
+
+            Service(std::string topic_name, std::string service_name, handler_t handler, dispatch_t dispatch) {
+                id = next_subscriber_id();
+                // clients may connect later, the channel has to exist beforehand
+                channel = MsgChannel<request_t>::create(topic_name, service_name);
+                // the slot's delegate only holds a pointer to both
+                boost::shared_ptr<std::pair<handler_t, dispatch_t>> server(new std::pair<handler_t, dispatch_t>(handler, dispatch));
+                bool added = channel->add_sole_slot([server](const request_t& request) {
+                    const handler_t& handler = server->first;
+                    if(!server->second) {
+                        serve(handler, request);
+                        return;
+                    }
+                    server->second([handler, request]() { serve(handler, request); });
+                }, SlotGate<request_t>(), id);
+                if(!added) {
+                    throw RpcError("a service already serves " + topic_name + "." + service_name);
+                }
+            }
+
+            static void serve(const handler_t& handler, const request_t& request) {
+                boost::shared_ptr<ReplyBox<Resp>> caller = request.reply_to.lock();
+                if(caller == nullptr || !caller->is_open(request.id)) return;
+                if(Clock::now() >= request.deadline) {
+                    caller->fail(request.id, std::make_exception_ptr(RpcError("rpc deadline passed before it was served")));
+                    return;
+                }
+                try {
+                    caller->reply(request.id, handler(request.request));
+                }
+                catch(...) {
+                    caller->fail(request.id, std::current_exception());
+                }
+            }
+
+            boost::shared_ptr<MsgChannel<request_t>> channel;
+            subscriber_id_t id;
+    };
+
+
+    template<class Req, class Resp>
+    class Client {
+        public:
+            typedef RpcRequest<Req, Resp> request_t;
+
+            Client(std::string topic_name, std::string service_name)
+                : publisher(topic_name, service_name), replies(new ReplyBox<Resp>()) {}
+
+            Client(std::string service_name) : Client(Default_Topic, service_name) {}
+
+            /* The future gets the handler's response, or rethrows what it threw. It fails with
+             * RpcError right away if no service serves the key, or if timeout_ms > 0 and the
+             * request was still waiting for the executor past its deadline */
+            std::future<Resp> call(const Req& request, unsigned int timeout_ms = 0) {
+                correlation_id_t id = next_id++;
+                std::future<Resp> reply = replies->open(id);
+                send(id, request, deadline(timeout_ms));
+                return reply;
+            }
+
+            /* Blocking call waiting at most timeout_ms of ITPS::Clock time (0: no limit),
+             * return false on timeout, the late reply is then dropped. Rethrows the handler's
+             * exception, or RpcError if the call couldn't be served */
+            bool call(const Req& request, Resp& response, unsigned int timeout_ms) {
+                correlation_id_t id = next_id++;
+                Clock::time_point until = deadline(timeout_ms);
+                std::future<Resp> reply = replies->open(id);
+                send(id, request, until);
+                if(!replies->wait(id, reply, until)) return false;
+                response = reply.get();
+                return true;
+            }
+
+            // a service is up for this key
+            bool connected() const {
+                return publisher.has_subscribers();
+            }
+
+        private:
+            static Clock::time_point deadline(unsigned int timeout_ms) {
+                if(timeout_ms == 0) return Clock::time_point::max();
+                return Clock::now() + boost::chrono::milliseconds(timeout_ms);
+            }
+
+            /* the publish itself tells whether a service took the request: checking connected()
+             * beforehand would race with a service going away in between, leaving the call
+             * pending forever */
+            void send(correlation_id_t id, const Req& request, Clock::time_point until) {
+                if(publisher.publish({id, request, replies, until}) == 0) {
+                    replies->fail(id, std::make_exception_ptr(RpcError("no service for this rpc")));
+                }
+            }
+
+            Publisher<request_t> publisher;
+            boost::shared_ptr<ReplyBox<Resp>> replies;
+            std::atomic<correlation_id_t> next_id{1};
+    };
+
+}
@@ -0,0 +1,239 @@
+/*
+ * Multi-topic time synchronizer, fuses the msgs of N subscribers into matched sets
+ */
+
+
+#pragma once
+#include <tuple>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <boost/circular_buffer.hpp>
+
+#include "inter_thread_pubsub.hpp"
+
+
+namespace ITPS {
+
+    /*
+     * A Synchronizer<M0, M1, ...> takes one msg stream per input, reads a timestamp from each
+     * msg through a user given function (any unit, as long as all inputs agree) and emits
+     * std::tuple<M0, M1, ...> sets to a callback and/or a queue.
+     *
+     * Policies:
+     *  * ExactTime: a set is made of msgs with identical stamps.
+     *  * ApproximateTime: the pivot of a set is the newest of the oldest buffered stamps of
+     *    all inputs, every input contributes its newest msg not newer than the pivot, and the
+     *    set is emitted when all of them lie within tolerance of the pivot (hence of each other).
+     *    An input only contributes once a msg newer than the pivot showed up on it (or one
+     *    stamped exactly at the pivot), so no better candidate can arrive afterwards.
+     *
+     * Each input is buffered in a ring of buffer_size msgs sorted by stamp, matching only
+     * binary-searches each buffer around the pivot. Msgs are assumed to arrive (mostly) in
+     * stamp order per input, out-of-order ones are inserted at their place.
+     * A msg is dropped, and counted in SyncStats::dropped of its input, when its buffer
+     * overflows or when it's skipped because it can't be part of any set anymore.
+     *
+     * Feed the inputs either by connect()-ing subscribers (their callbacks feed the
+     * synchronizer on the publishers' threads) or by calling add<I>() e.g. with msgs popped
+     * from queue subscribers. Sets are emitted on the feeding thread, in stamp order.
+     */
+    enum class SyncPolicy {
+        ExactTime,
+        ApproximateTime
+    };
+
+    struct SyncStats {
+        unsigned long matched = 0;          // number of sets emitted
+        std::vector<unsigned long> dropped; // per input, msgs that didn't make it into a set
+        std::vector<unsigned long> pending; // per input, msgs still buffered, waiting for a match
+    };
+
+    template<class... Msgs>
+    class Synchronizer {
+        public:
+            typedef std::tuple<Msgs...> msg_set_t;
+            static const size_t num_inputs = sizeof...(Msgs);
+
+            /* tolerance: only used by ApproximateTime
+             * stamp_of: one function per input, returning the timestamp of a msg */
+            Synchronizer(SyncPolicy policy, double tolerance, unsigned int buffer_size,
+                         boost::function<double(const Msgs&)>... stamp_of)
+                : state(new state_t(policy == SyncPolicy::ExactTime ? 0.0 : tolerance, buffer_size, stamp_of...)) {}
+
+            // the callbacks registered by connect() keep the internal state alive
+            Synchronizer(const Synchronizer&) = delete;
+            Synchronizer& operator=(const Synchronizer&) = delete;
+
+            // must be called before feeding any msg
+            void set_callback(boost::function<void(const msg_set_t&)> callback_function) {
+                state->callback = callback_function;
+            }
+
+            // must be called before feeding any msg
+            void set_queue(boost::shared_ptr<ConsumerProducerQueue<msg_set_t>> queue) {
+                state->queue = queue;
+            }
+
+            /* Feed the synchronizer from the callbacks of the subscribers, input I <- subs[I].
+             * the subscribers must already be subscribed */
+            template<class... Ts>
+            bool connect(Subscriber<Ts>&... subs) {
+                static_assert(sizeof...(Ts) == num_inputs, "one subscriber per input");
+                return connect_each(std::index_sequence_for<Msgs...>(), subs...);
+            }
+
+            // feed input I with a msg
+            template<size_t I>
+            void add(const typename std::tuple_element<I, msg_set_t>::type& msg) {
+                state->template add<I>(msg);
+            }
+
+            // don't call it from the callback set by set_callback(), sets are emitted under the same lock
+            SyncStats stats() {
+                boost::lock_guard<boost::mutex> guard(state->mutex);
+                SyncStats stats = state->stats;
+                stats.pending = state->pending(std::index_sequence_for<Msgs...>());
+                return stats;
+            }
+
+
+        protected:
+            template<class Msg>
+            struct stamped_t {
+                double stamp;
+                Msg msg;
+            };
+
+            struct state_t {
+                state_t(double tolerance, unsigned int buffer_size, boost::function<double(const Msgs&)>... stamp_of)
+                    : tolerance(tolerance), stamp_of(stamp_of...),
+                      buffers(boost::circular_buffer<stamped_t<Msgs>>(std::max(buffer_size, 1u))...) {
+                    stats.dropped.resize(num_inputs, 0);
+                }
+
+                template<size_t I, class Msg>
+                void add(const Msg& msg) {
+                    double stamp = std::get<I>(stamp_of)(msg);
+                    boost::lock_guard<boost::mutex> guard(mutex);
+
+                    auto& buffer = std::get<I>(buffers);
+                    if(buffer.full()) {
+                        buffer.pop_front();
+                        stats.dropped[I]++;
+                    }
+                    if(buffer.empty() || buffer.back().stamp <= stamp) {
+                        buffer.push_back({stamp, msg});
+                    }
+                    else {
+                        auto pos = std::upper_bound(buffer.begin(), buffer.end(), stamp,
+                                                    [](double s, const stamped_t<Msg>& e) { return s < e.stamp; });
+                        buffer.insert(pos, {stamp, msg});
+                    }
+
+                    match(std::index_sequence_for<Msgs...>());
+                }
+
+                // emit as many sets as possible, called with mutex held
+                template<size_t... I>
+                void match(std::index_sequence<I...>) {
+                    while(true) {
+                        if((std::get<I>(buffers).empty() || ...)) return;
+
+                        double pivot = std::max({std::get<I>(buffers).front().stamp...});
+
+                        // msgs older than pivot - tolerance can't be matched with the pivot
+                        // input, whose msgs are all at or after the pivot
+                        (skip_before<I>(pivot - tolerance), ...);
+                        if((std::get<I>(buffers).empty() || ...)) return;
+
+                        size_t chosen[] = {candidate<I>(pivot)...};
+                        bool moved = false;
+                        for(size_t c: chosen) {
+                            // not ready stays so with a later pivot
+                            if(c == not_ready) return;
+                            if(c == repivot) moved = true;
+                        }
+                        if(moved) continue;
+
+                        msg_set_t set(std::get<I>(buffers)[chosen[I]].msg...);
+                        (consume<I>(chosen[I]), ...);
+                        stats.matched++;
+
+                        if(callback) callback(set);
+                        if(queue) queue->produce(set);
+                    }
+                }
+
+                template<size_t... I>
+                std::vector<unsigned long> pending(std::index_sequence<I...>) {
+                    return {std::get<I>(buffers).size()...};
+                }
+
+                template<size_t I>
+                void skip_before(double stamp) {
+                    auto& buffer = std::get<I>(buffers);
+                    while(!buffer.empty() && buffer.front().stamp < stamp) {
+                        buffer.pop_front();
+                        stats.dropped[I]++;
+                    }
+                }
+
+                /* index of the newest msg not newer than the pivot. Once skip_before() dropped
+                 * the older msgs, the head may be newer than the pivot: the pivot then has to
+                 * move up to it (repivot) */
+                template<size_t I>
+                size_t candidate(double pivot) {
+                    auto& buffer = std::get<I>(buffers);
+                    auto pos = std::upper_bound(buffer.begin(), buffer.end(), pivot,
+                                                [](double s, const stamped_t<typename std::tuple_element<I, msg_set_t>::type>& e) {
+                                                    return s < e.stamp;
+                                                });
+                    if(pos == buffer.begin()) {
+                        return repivot;
+                    }
+                    size_t index = (pos - buffer.begin()) - 1;
+                    if(pos == buffer.end() && buffer[index].stamp < pivot) {
+                        return not_ready; // a closer msg may still come
+                    }
+                    return index;
+                }
+
+                // remove the chosen msg & the ones before it, which are skipped
+                template<size_t I>
+                void consume(size_t chosen) {
+                    auto& buffer = std::get<I>(buffers);
+                    stats.dropped[I] += chosen;
+                    buffer.erase_begin(chosen + 1);
+                }
+
+                static const size_t not_ready = size_t(-1);
+                static const size_t repivot = size_t(-2);
+
+                boost::mutex mutex;
+                double tolerance;
+                std::tuple<boost::function<double(const Msgs&)>...> stamp_of;
+                std::tuple<boost::circular_buffer<stamped_t<Msgs>>...> buffers;
+                SyncStats stats;
+                boost::function<void(const msg_set_t&)> callback;
+                boost::shared_ptr<ConsumerProducerQueue<msg_set_t>> queue;
+            };
+
+            template<size_t... I, class... Ts>
+            bool connect_each(std::index_sequence<I...>, Subscriber<Ts>&... subs) {
+                boost::shared_ptr<state_t> state = this->state;
+                bool connected[] = {
+                    subs.add_on_published_callback([state](typename Subscriber<Ts>::Msg msg) {
+                        state->template add<I>(msg);
+                    })...
+                };
+                for(bool c: connected) {
+                    if(!c) return false;
+                }
+                return true;
+            }
+
+            boost::shared_ptr<state_t> state;
+    };
+
+}
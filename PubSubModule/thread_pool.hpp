@@ -4,7 +4,51 @@
 #include <boost/thread/thread.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <vector>
+#include <future>
+#include <atomic>
+#include <type_traits>
+
+//-------------------------------------------------------------------------------------------------------------------//
+
+/* Cooperative cancellation: the owner of a StopSource requests the stop, the tasks holding
+ * one of its tokens check stop_requested() at convenient points and return early. */
+class StopToken {
+public:
+    StopToken() : flag(new std::atomic<bool>(false)) {} // never stopped
+
+    bool stop_requested() const {
+        return flag->load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class StopSource;
+    StopToken(boost::shared_ptr<std::atomic<bool>> flag) : flag(flag) {}
+    boost::shared_ptr<std::atomic<bool>> flag;
+};
+
+class StopSource {
+public:
+    StopSource() : flag(new std::atomic<bool>(false)) {}
+
+    void request_stop() {
+        *flag = true;
+    }
+
+    bool stop_requested() const {
+        return *flag;
+    }
+
+    StopToken token() const {
+        return StopToken(flag);
+    }
+
+private:
+    boost::shared_ptr<std::atomic<bool>> flag;
+};
 
 //-------------------------------------------------------------------------------------------------------------------//
 
@@ -12,24 +56,34 @@
 
 class ThreadPool {
 public:
-    ThreadPool(unsigned int num_threads) : io_work(ios) {
+    ThreadPool(unsigned int num_threads) : io_work(new boost::asio::io_service::work(ios)) {
         for (int i = 0; i < num_threads; i++) {
             threads.create_thread(boost::bind(&boost::asio::io_service::run, &ios));
         }
     }
 
+    /* Queued tasks still run (the destructor drains the pool), call stop() first to drop them */
     ~ThreadPool() {
-        ios.stop();
+        io_work.reset(); // the threads return once the queue is empty
         try { // suppress all exceptions 
             threads.join_all(); // wait for all threads to terminate
         }
         catch ( const std::exception& ) {}
     }
 
+    /* Returns a future of the result of func(), which also carries its exception if it threw.
+     * A task dropped by stop() before running leaves its future with std::future_error
+     * (broken_promise). */
     template<class Function>
-    void execute(Function func) {
-        ios.post(func); // add the function to the io_service queue 
-                        // to be run in the threads created in the constructor
+    std::future<typename std::result_of<Function()>::type> execute(Function func) {
+        typedef typename std::result_of<Function()>::type result_t;
+        // asio copies handlers, the packaged_task & the in-flight count are shared by the copies
+        boost::shared_ptr<std::packaged_task<result_t()>> task(new std::packaged_task<result_t()>(func));
+        boost::shared_ptr<completion_t> completion(new completion_t(this));
+        std::future<result_t> result = task->get_future();
+
+        ios.post([task, completion]() { (*task)(); }); // add the function to the io_service queue 
+                                                       // to be run in the threads created in the constructor
         // non-blocking, return immediately
 
         /* if there aren't available threads in the pool, i.e. every
@@ -45,6 +99,26 @@ public:
                 https://stackoverflow.com/questions/12215395/thread-pool-using-boost-asio/12267138#12267138
         */
        num_tasks++;
+       return result;
+    }
+
+    /* block until every task posted so far (and those they post) has finished or was dropped */
+    void drain() {
+        boost::unique_lock<boost::mutex> lock(drain_mutex);
+        while(in_flight > 0) {
+            drained.wait(lock);
+        }
+    }
+
+    /* drop the queued tasks that haven't started, running ones finish (request their stop 
+     * through their StopSource to make it quick). The pool can't be used afterwards */
+    void stop() {
+        ios.stop();
+    }
+
+    // tasks queued or running
+    unsigned int num_in_flight() {
+        return in_flight;
     }
 
     /* total CUMULATIVE number of tasks ever being posted by ThreadPool::execute,
@@ -55,9 +129,28 @@ public:
     }
 
 private:
+    /* destroyed along with the last copy of its handler, whether the task ran or got dropped */
+    struct completion_t {
+        ThreadPool *pool;
+        completion_t(ThreadPool *pool) : pool(pool) {
+            pool->in_flight++;
+        }
+        ~completion_t() {
+            boost::lock_guard<boost::mutex> guard(pool->drain_mutex);
+            if(--pool->in_flight == 0) {
+                pool->drained.notify_all();
+            }
+        }
+    };
+
+    // declared first: destroyed after ios, whose destructor releases the dropped handlers
+    std::atomic<unsigned int> in_flight{0};
+    boost::mutex drain_mutex;
+    boost::condition_variable drained;
+
     boost::thread_group threads;
     boost::asio::io_service ios;
-    boost::asio::io_service::work io_work;
+    boost::shared_ptr<boost::asio::io_service::work> io_work;
     unsigned int num_tasks = 0; // this includes those tasks that finished early and got dequeued,
                             // this measurement can't deduce anything about the
                             // the current available free threads
@@ -0,0 +1,128 @@
+/*
+ * Prefix index over hierarchical topic keys, used by ITPS to resolve wildcard subscriptions
+ */
+
+
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <unordered_map>
+#include <boost/shared_ptr.hpp>
+
+
+namespace ITPS {
+
+    /*
+     * Channel keys ("topic_name.msg_name") are treated as hierarchical names whose segments
+     * are separated by either '.' or '/', e.g. "sensors/imu.accel" == {"sensors", "imu", "accel"}.
+     *
+     * Wildcard patterns:
+     *  * "*"  matches exactly one segment,   e.g. "Topic1.*"   matches "Topic1.Msg1"
+     *  * "**" matches zero or more segments, e.g. "sensors.**" matches "sensors/imu.accel"
+     *
+     * The trie is only walked when a wildcard subscription is made, exact-match lookups
+     * keep going through the channel hash table.
+     */
+    class TopicTrie {
+        public:
+            typedef std::vector<std::string> segments_t;
+
+            static segments_t split(const std::string& key) {
+                segments_t segments;
+                std::string segment;
+                for(char c: key) {
+                    if(c == '.' || c == '/') {
+                        segments.push_back(segment);
+                        segment.clear();
+                    }
+                    else {
+                        segment += c;
+                    }
+                }
+                segments.push_back(segment);
+                return segments;
+            }
+
+            static bool is_pattern(const std::string& key) {
+                return key.find('*') != std::string::npos;
+            }
+
+            /* check a single key against a pattern, used when a new channel shows up after
+             * the wildcard subscription was made */
+            static bool matches(const segments_t& pattern, const segments_t& key, size_t p = 0, size_t k = 0) {
+                if(p == pattern.size()) {
+                    return k == key.size();
+                }
+                if(pattern[p] == "**") {
+                    // either "**" stops here, or it swallows one more segment
+                    return matches(pattern, key, p + 1, k) || (k < key.size() && matches(pattern, key, p, k + 1));
+                }
+                if(k == key.size()) {
+                    return false;
+                }
+                if(pattern[p] == "*" || pattern[p] == key[k]) {
+                    return matches(pattern, key, p + 1, k + 1);
+                }
+                return false;
+            }
+
+            void insert(const std::string& key) {
+                Node *node = &root;
+                for(auto& segment: split(key)) {
+                    auto& child = node->children[segment];
+                    if(child == nullptr) {
+                        child = boost::shared_ptr<Node>(new Node());
+                    }
+                    node = child.get();
+                }
+                // a channel re-created under the same key is inserted again
+                if(std::find(node->keys.begin(), node->keys.end(), key) == node->keys.end()) {
+                    node->keys.push_back(key);
+                }
+            }
+
+            /* return every inserted key matching the pattern, in lexicographical order */
+            std::vector<std::string> match(const segments_t& pattern) const {
+                std::set<std::string> found; // multiple "**" may reach the same node more than once
+                collect(root, pattern, 0, found);
+                return std::vector<std::string>(found.begin(), found.end());
+            }
+
+        private:
+            struct Node {
+                std::unordered_map<std::string, boost::shared_ptr<Node>> children;
+                std::vector<std::string> keys; // "a.b" and "a/b" end up in the same node
+            };
+
+            static void collect(const Node& node, const segments_t& pattern, size_t p, std::set<std::string>& found) {
+                if(p == pattern.size()) {
+                    found.insert(node.keys.begin(), node.keys.end());
+                    return;
+                }
+
+                const std::string& segment = pattern[p];
+                if(segment == "**") {
+                    collect(node, pattern, p + 1, found);
+                    for(auto& child: node.children) {
+                        collect(*child.second, pattern, p, found);
+                    }
+                }
+                else if(segment == "*") {
+                    for(auto& child: node.children) {
+                        collect(*child.second, pattern, p + 1, found);
+                    }
+                }
+                else {
+                    auto child = node.children.find(segment);
+                    if(child != node.children.end()) {
+                        collect(*child->second, pattern, p + 1, found);
+                    }
+                }
+            }
+
+            Node root;
+    };
+
+}
@@ -0,0 +1,318 @@
+/*
+ * Opt-in message flow tracer for ITPS, exports Chrome trace JSON (also opened by Perfetto)
+ */
+
+
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <ostream>
+#include <cstdio>
+#include <boost/shared_ptr.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+
+namespace ITPS {
+
+    /*
+     * Tracer::enable() starts recording, on every thread touching ITPS:
+     *  * publish:          publisher, whole MsgChannel::set_msg() (fan-out included)
+     *  * enqueue:          publisher, one per subscriber queue
+     *  * blocked-on-full:  publisher, an enqueue that had to wait for room in a full queue
+     *  * dequeue:          subscriber, Subscriber::pop_msg() / try_pop_msg() / wait_msg() and
+     *                      the pops of consumer group members
+     *  * callback:         publisher, one per observer callback (start to end)
+     * each with the channel key and the msg seq (the channel version of the publish, see
+     * Subscriber::latest()). The publish and its dequeues are linked by flow arrows, so the
+     * path of one msg across threads shows up in chrome://tracing or ui.perfetto.dev.
+     * A queued msg carries both as a tag (check tag()), so a wildcard subscriber's dequeue
+     * names the channel the msg came from.
+     *
+     * The thread name (set_thread_name()) is recorded with each event: a pool worker running
+     * several modules one after the other shows up as one row per module name.
+     *
+     * Events go into a per-thread ring of events_per_thread events (the oldest ones get
+     * overwritten), written by that thread only, no lock and no allocation on the hot path.
+     * While disabled, the cost is one relaxed atomic load per publish / pop, and defining
+     * ITPS_DISABLE_TRACING compiles the tracer out altogether.
+     *
+     * write_chrome_json() is meant to be called once the traced activity is over (or after
+     * disable()), events being written concurrently may come out torn.
+     */
+    class Tracer {
+        public:
+            enum event_type_t : unsigned int {
+                Publish,
+                Enqueue,
+                BlockedOnFull,
+                Dequeue,
+                Callback
+            };
+
+            // interned channel key, lives until the end of the program
+            struct key_t {
+                std::string name;
+                unsigned int index;
+                bool operator<(const key_t& other) const { return name < other.name; }
+            };
+
+            static bool enabled() {
+#ifdef ITPS_DISABLE_TRACING
+                return false;
+#else
+                return state().enabled.load(std::memory_order_relaxed);
+#endif
+            }
+
+            static void enable(size_t events_per_thread = 65536) {
+                state().events_per_thread = std::max<size_t>(events_per_thread, 1);
+                state().enabled = true;
+            }
+
+            static void disable() {
+                state().enabled = false;
+            }
+
+            /* name of the calling thread in the trace for the events recorded from now on,
+             * can be called before enable() */
+            static void set_thread_name(std::string name) {
+                thread_name() = intern(name);
+            }
+
+            /* restore the thread name of the calling thread on destruction, e.g. around a task
+             * run by a pool worker that names itself */
+            class ThreadNameScope {
+                public:
+                    ThreadNameScope() : saved(thread_name()) {}
+                    ~ThreadNameScope() { thread_name() = saved; }
+
+                    ThreadNameScope(const ThreadNameScope&) = delete;
+                    ThreadNameScope& operator=(const ThreadNameScope&) = delete;
+
+                private:
+                    const key_t *saved;
+            };
+
+            static const key_t* intern(const std::string& name) {
+                boost::lock_guard<boost::mutex> guard(state().mutex);
+                auto& keys = state().keys;
+                auto it = keys.find(key_t{name, 0});
+                if(it == keys.end()) {
+                    it = keys.insert(key_t{name, (unsigned int)keys.size()}).first;
+                }
+                return &*it; // std::set nodes never move
+            }
+
+            static long long now() {
+                return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                    boost::chrono::steady_clock::now().time_since_epoch()).count();
+            }
+
+            /* the channel key & the msg seq packed into the tag of a queued msg: key index + 1
+             * in the high 24 bits, the low 40 bits of seq below. 0 means untagged */
+            static unsigned long long tag(const key_t *key, unsigned long long seq) {
+                return ((unsigned long long)(key ? key->index + 1 : 0) << seq_bits) | (seq & seq_mask);
+            }
+
+            /* the tag of the publish running on this thread, 0 outside of one, for slots
+             * that queue the msg themselves (e.g. consumer groups) */
+            static unsigned long long publishing() {
+                return current_publish();
+            }
+
+            // marks the publish of tag on this thread while in scope, a no-op if !active
+            class PublishScope {
+                public:
+                    PublishScope(bool active, unsigned long long tag) : active(active) {
+                        if(!active) return;
+                        saved = current_publish();
+                        current_publish() = tag;
+                    }
+                    ~PublishScope() {
+                        if(active) current_publish() = saved;
+                    }
+
+                    PublishScope(const PublishScope&) = delete;
+                    PublishScope& operator=(const PublishScope&) = delete;
+
+                private:
+                    bool active;
+                    unsigned long long saved = 0;
+            };
+
+            // called only when enabled()
+            static void record(event_type_t type, const key_t *key, unsigned long long seq,
+                               long long start_ns, long long end_ns, unsigned long long subscriber = 0) {
+                record_tagged(type, tag(key, seq), start_ns, end_ns, subscriber);
+            }
+
+            // called only when enabled(), with the tag of the msg (check tag())
+            static void record_tagged(event_type_t type, unsigned long long tag,
+                                      long long start_ns, long long end_ns, unsigned long long subscriber = 0) {
+                buffer_t *buffer = local_buffer();
+                if(buffer == nullptr) {
+                    buffer = register_thread();
+                }
+                size_t head = buffer->head.load(std::memory_order_relaxed);
+                event_t& event = buffer->ring[head % buffer->ring.size()];
+                event.type = type;
+                event.tag = tag;
+                event.thread_name = thread_name();
+                event.start_ns = start_ns;
+                event.end_ns = end_ns;
+                event.subscriber = subscriber;
+                buffer->head.store(head + 1, std::memory_order_release);
+            }
+
+            // drop every recorded event
+            static void clear() {
+                boost::lock_guard<boost::mutex> guard(state().mutex);
+                for(auto& buffer: state().buffers) {
+                    buffer->tail = buffer->head.load(std::memory_order_acquire);
+                }
+            }
+
+            static void write_chrome_json(std::ostream& out) {
+                boost::lock_guard<boost::mutex> guard(state().mutex);
+                static const char *names[] = {"publish", "enqueue", "blocked-on-full", "dequeue", "callback"};
+                char line[512];
+                bool first = true;
+                auto emit = [&](const char *text) {
+                    out << (first ? "\n  " : ",\n  ") << text;
+                    first = false;
+                };
+
+                // interned names by index + 1, for the key index of the tags
+                std::vector<const key_t*> names_by_index(state().keys.size() + 1, nullptr);
+                for(auto& interned: state().keys) {
+                    names_by_index[interned.index + 1] = &interned;
+                }
+                // one trace row per OS thread & thread name
+                std::map<std::pair<unsigned int, const key_t*>, unsigned int> rows;
+
+                out << "{\"traceEvents\": [";
+                for(auto& buffer: state().buffers) {
+                    size_t head = buffer->head.load(std::memory_order_acquire);
+                    size_t begin = std::max(buffer->tail, head > buffer->ring.size() ? head - buffer->ring.size() : 0);
+                    for(size_t i = begin; i < head; i++) {
+                        const event_t& event = buffer->ring[i % buffer->ring.size()];
+                        auto row = rows.find({buffer->tid, event.thread_name});
+                        if(row == rows.end()) {
+                            row = rows.insert({{buffer->tid, event.thread_name}, (unsigned int)rows.size() + 1}).first;
+                            std::string name = event.thread_name ? event.thread_name->name : "thread " + std::to_string(buffer->tid);
+                            snprintf(line, sizeof(line), "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                                     row->second, escape(name).c_str());
+                            emit(line);
+                        }
+                        unsigned int tid = row->second;
+
+                        unsigned long long key_index = event.tag >> seq_bits;
+                        unsigned long long seq = event.tag & seq_mask;
+                        const key_t *interned = key_index < names_by_index.size() ? names_by_index[key_index] : nullptr;
+                        std::string key = escape(interned ? interned->name : "");
+                        double ts = (event.start_ns - state().epoch_ns) / 1000.0;
+                        double dur = (event.end_ns - event.start_ns) / 1000.0;
+                        // flow id: the tag, channel index in the high bits, seq in the low bits
+                        unsigned long long flow_id = event.tag;
+
+                        if(event.type == Dequeue) {
+                            snprintf(line, sizeof(line), "{\"ph\": \"i\", \"s\": \"t\", \"name\": \"%s\", \"cat\": \"itps\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+                                     "\"args\": {\"key\": \"%s\", \"seq\": %llu}}",
+                                     names[event.type], tid, ts, key.c_str(), seq);
+                            emit(line);
+                            snprintf(line, sizeof(line), "{\"ph\": \"f\", \"bp\": \"e\", \"name\": \"msg\", \"cat\": \"itps\", \"id\": \"0x%llx\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f}",
+                                     flow_id, tid, ts);
+                            emit(line);
+                            continue;
+                        }
+
+                        snprintf(line, sizeof(line), "{\"ph\": \"X\", \"name\": \"%s\", \"cat\": \"itps\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+                                 "\"args\": {\"key\": \"%s\", \"seq\": %llu, \"subscriber\": %llu}}",
+                                 names[event.type], tid, ts, dur, key.c_str(), seq, event.subscriber);
+                        emit(line);
+                        if(event.type == Publish) {
+                            snprintf(line, sizeof(line), "{\"ph\": \"s\", \"name\": \"msg\", \"cat\": \"itps\", \"id\": \"0x%llx\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f}",
+                                     flow_id, tid, ts);
+                            emit(line);
+                        }
+                    }
+                }
+                out << "\n], \"displayTimeUnit\": \"ns\"}" << std::endl;
+            }
+
+        private:
+            static const unsigned int seq_bits = 40;
+            static const unsigned long long seq_mask = (1ULL << seq_bits) - 1;
+
+            struct event_t {
+                long long start_ns, end_ns;
+                unsigned long long tag, subscriber;
+                const key_t *thread_name; // nullptr if the thread wasn't named
+                event_type_t type;
+            };
+
+            struct buffer_t {
+                unsigned int tid;
+                std::vector<event_t> ring;
+                std::atomic<size_t> head{0};
+                size_t tail = 0; // events before it were cleared
+            };
+
+            struct state_t {
+                std::atomic<bool> enabled{false};
+                size_t events_per_thread = 65536;
+                long long epoch_ns = Tracer::now();
+                boost::mutex mutex;
+                std::set<key_t> keys;
+                std::vector<boost::shared_ptr<buffer_t>> buffers; // kept after their thread exits
+            };
+
+            static state_t& state() {
+                static state_t s;
+                return s;
+            }
+
+            static buffer_t*& local_buffer() {
+                static thread_local buffer_t *buffer = nullptr;
+                return buffer;
+            }
+
+            static const key_t*& thread_name() {
+                static thread_local const key_t *name = nullptr;
+                return name;
+            }
+
+            static unsigned long long& current_publish() {
+                static thread_local unsigned long long tag = 0;
+                return tag;
+            }
+
+            // first event of this thread, allocates its ring
+            static buffer_t* register_thread() {
+                boost::shared_ptr<buffer_t> buffer(new buffer_t());
+                buffer->ring.resize(state().events_per_thread);
+                boost::lock_guard<boost::mutex> guard(state().mutex);
+                buffer->tid = (unsigned int)state().buffers.size() + 1;
+                state().buffers.push_back(buffer);
+                local_buffer() = buffer.get();
+                return buffer.get();
+            }
+
+            static std::string escape(const std::string& text) {
+                std::string escaped;
+                for(char c: text) {
+                    if(c == '"' || c == '\\') escaped += '\\';
+                    if((unsigned char)c < 0x20) continue;
+                    escaped += c;
+                }
+                return escaped.substr(0, 200);
+            }
+    };
+
+}
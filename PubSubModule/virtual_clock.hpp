@@ -0,0 +1,334 @@
+/*
+ * Pluggable time source for ITPS timeouts & sleeps, real (steady clock) or virtual
+ */
+
+
+#pragma once
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+
+namespace ITPS {
+
+    /*
+     * Simulated time that only moves when every participant thread is blocked: it then jumps
+     * straight to the earliest deadline among them (a sleep, or a timed pop / wait), so a
+     * scenario runs as fast as the CPU allows and its timing doesn't depend on the machine.
+     *
+     * Participants are the threads that take part in the simulation, each one holds a
+     * VirtualClock::Participant for as long as it runs. A thread that is about to be started
+     * can be accounted for beforehand with reserve(), so that time doesn't move before it
+     * got the chance to run. A participant counts as blocked while it sleeps through Clock
+     * or waits on a ClockCondition (every wait inside ITPS queues & channels), and nowhere
+     * else: a participant spinning, computing or waiting on something else holds time still.
+     * Non-participant threads see virtual timestamps but wait in real time.
+     *
+     * Time only jumps when all participants are blocked and at least one has a deadline. If
+     * none has, they're deadlocked (e.g. all popping empty queues) and time stands still.
+     */
+    class VirtualClock {
+        public:
+            typedef boost::chrono::steady_clock::time_point time_point;
+            typedef boost::chrono::steady_clock::duration duration;
+
+            VirtualClock(time_point start = boost::chrono::steady_clock::now())
+                : current(start.time_since_epoch().count()) {}
+
+            VirtualClock(const VirtualClock&) = delete;
+            VirtualClock& operator=(const VirtualClock&) = delete;
+
+            time_point now() const {
+                return time_point(duration(current.load()));
+            }
+
+            // move time forward by hand (e.g. from a test driver), firing the deadlines passed
+            void advance(duration step) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                current += step.count();
+                fire();
+            }
+
+            // count num_threads threads as running participants until they construct their Participant
+            void reserve(unsigned int num_threads = 1) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                reserved += num_threads;
+            }
+
+            /* RAII registration of the calling thread, a thread participates in one clock at a
+             * time. A null clock does nothing, so modules can hold one unconditionally */
+            class Participant {
+                public:
+                    Participant(VirtualClock *clock) : clock(clock) {
+                        if(clock) clock->join(&self);
+                    }
+                    ~Participant() {
+                        if(clock) clock->leave(&self);
+                    }
+                    Participant(const Participant&) = delete;
+                    Participant& operator=(const Participant&) = delete;
+                private:
+                    friend class VirtualClock;
+                    struct state_t {
+                        bool blocked = false;
+                        bool timed = false;
+                        time_point deadline;
+                        boost::condition_variable_any *cond = nullptr; // what it waits on, if not sleeping
+                    };
+                    VirtualClock *clock;
+                    state_t self;
+            };
+
+            // false if the calling thread isn't a participant of this clock
+            bool is_participant() const {
+                return local() != nullptr && local_clock() == this;
+            }
+
+            /* for Clock & ClockCondition, the caller must be a participant */
+            void sleep_until(time_point deadline) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if(deadline <= now()) return;
+                block(local(), nullptr, true, deadline);
+                while(local()->blocked) {
+                    ticked.wait(lock);
+                }
+            }
+
+            void begin_wait(boost::condition_variable_any *cond, bool timed, time_point deadline) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                block(local(), cond, timed, deadline);
+            }
+
+            // still blocked: neither notified through its ClockCondition nor past its deadline
+            bool waiting() {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                return local()->blocked;
+            }
+
+            void end_wait() {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                unblock(local());
+                local()->cond = nullptr;
+            }
+
+            // the participants waiting on cond are about to be notified, they're running again
+            void notify(boost::condition_variable_any *cond) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                for(auto participant: participants) {
+                    if(participant->blocked && participant->cond == cond) {
+                        unblock(participant);
+                    }
+                }
+            }
+
+        private:
+            typedef Participant::state_t state_t;
+
+            static state_t*& local() {
+                static thread_local state_t *state = nullptr;
+                return state;
+            }
+
+            static const VirtualClock*& local_clock() {
+                static thread_local const VirtualClock *clock = nullptr;
+                return clock;
+            }
+
+            void join(state_t *state) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                if(reserved > 0) reserved--;
+                participants.push_back(state);
+                local() = state;
+                local_clock() = this;
+            }
+
+            void leave(state_t *state) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                unblock(state);
+                participants.erase(std::remove(participants.begin(), participants.end(), state), participants.end());
+                local() = nullptr;
+                local_clock() = nullptr;
+                maybe_jump();
+            }
+
+            // all called with mutex held
+            void block(state_t *state, boost::condition_variable_any *cond, bool timed, time_point deadline) {
+                state->blocked = true;
+                state->timed = timed;
+                state->deadline = deadline;
+                state->cond = cond;
+                num_blocked++;
+                maybe_jump();
+            }
+
+            void unblock(state_t *state) {
+                if(!state->blocked) return;
+                state->blocked = false;
+                num_blocked--;
+            }
+
+            void maybe_jump() {
+                if(reserved > 0 || num_blocked < participants.size() || participants.empty()) return;
+                bool found = false;
+                time_point earliest;
+                for(auto participant: participants) {
+                    if(participant->timed && (!found || participant->deadline < earliest)) {
+                        earliest = participant->deadline;
+                        found = true;
+                    }
+                }
+                if(!found) return; // deadlock, nothing to jump to
+                if(earliest > now()) {
+                    current = earliest.time_since_epoch().count();
+                }
+                fire();
+            }
+
+            // wake every participant whose deadline has passed
+            void fire() {
+                bool any = false;
+                for(auto participant: participants) {
+                    if(participant->blocked && participant->timed && participant->deadline <= now()) {
+                        unblock(participant);
+                        if(participant->cond) participant->cond->notify_all();
+                        any = true;
+                    }
+                }
+                if(any) ticked.notify_all();
+            }
+
+            std::atomic<duration::rep> current;
+            boost::mutex mutex;
+            boost::condition_variable_any ticked; // sleepers wait on it
+            std::vector<state_t*> participants;
+            size_t num_blocked = 0;
+            unsigned int reserved = 0;
+    };
+
+
+    /*
+     * The clock behind every ITPS timeout (timed pops, wait_newer(), rate limits, publish
+     * stamps) and behind the delay() / millis() of modules. Real steady clock by default,
+     * Clock::install() switches the whole process to a VirtualClock. Install it before any
+     * thread starts waiting, and uninstall it (install(nullptr)) once they're all done.
+     */
+    class Clock {
+        public:
+            typedef boost::chrono::steady_clock::time_point time_point;
+            typedef boost::chrono::steady_clock::duration duration;
+
+            static void install(VirtualClock *clock) {
+                current() = clock;
+            }
+
+            // nullptr when running on real time
+            static VirtualClock* virtual_clock() {
+                return current().load(std::memory_order_relaxed);
+            }
+
+            static time_point now() {
+                VirtualClock *clock = virtual_clock();
+                return clock ? clock->now() : boost::chrono::steady_clock::now();
+            }
+
+            static void sleep_until(time_point deadline) {
+                VirtualClock *clock = virtual_clock();
+                if(clock && clock->is_participant()) {
+                    clock->sleep_until(deadline);
+                    return;
+                }
+                if(clock) {
+                    // a non-participant sleeps the remaining virtual time for real
+                    boost::this_thread::sleep_for(deadline - clock->now());
+                    return;
+                }
+                boost::this_thread::sleep_until(deadline);
+            }
+
+            static void sleep_for(duration span) {
+                sleep_until(now() + span);
+            }
+
+            static void delay(unsigned int milliseconds) {
+                sleep_for(boost::chrono::milliseconds(milliseconds));
+            }
+
+            static unsigned int millis() {
+                return (unsigned int) boost::chrono::duration_cast<boost::chrono::milliseconds>(now().time_since_epoch()).count();
+            }
+
+        private:
+            static std::atomic<VirtualClock*>& current() {
+                static std::atomic<VirtualClock*> clock{nullptr};
+                return clock;
+            }
+    };
+
+
+    /* boost::condition_variable_any whose waits & notifies are accounted for by the installed
+     * VirtualClock, deadlines are Clock time points. Every notify of a waiter must go through
+     * notify_all(). */
+    class ClockCondition {
+        public:
+            template<class Lock>
+            void wait(Lock& lock) {
+                VirtualClock *clock = participant_clock();
+                if(clock == nullptr) {
+                    cond.wait(lock);
+                    return;
+                }
+                clock->begin_wait(&cond, false, Clock::time_point());
+                while(clock->waiting()) {
+                    cond.wait(lock);
+                }
+                clock->end_wait();
+            }
+
+            // false on timeout
+            template<class Lock>
+            bool wait_until(Lock& lock, Clock::time_point deadline) {
+                VirtualClock *clock = Clock::virtual_clock();
+                if(clock == nullptr) {
+                    return cond.wait_until(lock, deadline) == boost::cv_status::no_timeout;
+                }
+                if(!clock->is_participant()) {
+                    cond.wait_for(lock, deadline - clock->now());
+                    return clock->now() < deadline;
+                }
+                clock->begin_wait(&cond, true, deadline);
+                while(clock->waiting()) {
+                    // the clock notifies on the deadline, the timeout covers a wait entered right after
+                    cond.wait_for(lock, boost::chrono::milliseconds(1));
+                }
+                clock->end_wait();
+                return clock->now() < deadline;
+            }
+
+            template<class Lock, class Predicate>
+            bool wait_until(Lock& lock, Clock::time_point deadline, Predicate pred) {
+                while(!pred()) {
+                    if(!wait_until(lock, deadline)) return pred();
+                }
+                return true;
+            }
+
+            void notify_all() {
+                VirtualClock *clock = Clock::virtual_clock();
+                if(clock) clock->notify(&cond);
+                cond.notify_all();
+            }
+
+        private:
+            static VirtualClock* participant_clock() {
+                VirtualClock *clock = Clock::virtual_clock();
+                return (clock && clock->is_participant()) ? clock : nullptr;
+            }
+
+            boost::condition_variable_any cond;
+    };
+
+}
@@ -0,0 +1,264 @@
+/*
+ * Variable-length record ring for string & blob topics, payloads stored inline
+ */
+
+
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+#include "cp_queue.hpp"
+
+
+namespace ITPS {
+
+    /* Msg types a ByteRing can carry: contiguous bytes with data() & size() */
+    template<class T>
+    struct byte_msg_traits {
+        static const bool value = false;
+    };
+
+    template<>
+    struct byte_msg_traits<std::string> {
+        static const bool value = true;
+        static std::string_view bytes(const std::string& msg) { return msg; }
+    };
+
+    template<>
+    struct byte_msg_traits<std::vector<char>> {
+        static const bool value = true;
+        static std::string_view bytes(const std::vector<char>& msg) { return {msg.data(), msg.size()}; }
+    };
+
+    template<>
+    struct byte_msg_traits<std::vector<unsigned char>> {
+        static const bool value = true;
+        static std::string_view bytes(const std::vector<unsigned char>& msg) {
+            return {reinterpret_cast<const char*>(msg.data()), msg.size()};
+        }
+    };
+
+    /*
+     * Queue of variable-length records in one buffer of capacity bytes, allocated once:
+     * each record is a 4-byte length followed by its payload, padded to 8 bytes. A record that
+     * doesn't fit before the end of the buffer is written at its start, the tail end is then
+     * skipped (a wrap marker in place of the length). Producing copies the payload into the
+     * ring, there is no per-record object, so a std::string msg costs no allocation in the
+     * queue and consecutive records are adjacent in memory.
+     *
+     * The consumer reads the record in place: acquire() returns a view of the oldest record,
+     * valid until release() frees its bytes for the producers. A single consumer thread, any
+     * number of producers (serialized by the ring's lock). Blocking & closing behave like
+     * ConsumerProducerQueue with OverflowPolicy::Block, timeouts are in ITPS::Clock time.
+     * A record larger than the ring can never fit, it's dropped and counted in dropped().
+     */
+    class ByteRing {
+        public:
+            ByteRing(size_t capacity_bytes)
+                : buffer(std::max<size_t>(align(capacity_bytes), 2 * header_bytes)) {
+                QueueBudget::charge(buffer.size());
+            }
+
+            ByteRing(const ByteRing&) = delete;
+            ByteRing& operator=(const ByteRing&) = delete;
+
+            ~ByteRing() {
+                QueueBudget::release(buffer.size());
+            }
+
+            // bytes taken by a record of payload_size in the ring
+            static size_t record_bytes(size_t payload_size) {
+                return align(header_bytes + payload_size);
+            }
+
+            /* copy the payload into the ring, waiting for room, return true if it had to wait */
+            bool produce(std::string_view payload) {
+                bool waited = false;
+                boost::unique_lock<boost::mutex> lock(mu);
+                if(record_bytes(payload.size()) > buffer.size()) {
+                    num_dropped++;
+                    return false;
+                }
+                while(!fits(payload.size()) && !closed) {
+                    cond_not_full.wait(lock);
+                    waited = true;
+                }
+                if(closed) {
+                    // nobody consumes a closed ring anymore, drop the record
+                    return waited;
+                }
+                push(payload);
+                lock.unlock();
+                cond_not_empty.notify_all();
+                return waited;
+            }
+
+            /* Non-blocking produce: return false instead of waiting when there's no room */
+            bool try_produce(std::string_view payload) {
+                boost::unique_lock<boost::mutex> lock(mu);
+                if(closed || !fits(payload.size())) {
+                    return false;
+                }
+                push(payload);
+                lock.unlock();
+                cond_not_empty.notify_all();
+                return true;
+            }
+
+            /* block until a record is available, return false once the ring is closed and
+             * drained. The view stays valid until release() */
+            bool acquire(std::string_view& record) {
+                boost::unique_lock<boost::mutex> lock(mu);
+                while(num_records == 0 && !closed) {
+                    cond_not_empty.wait(lock);
+                }
+                if(num_records == 0) return false;
+                record = peek();
+                return true;
+            }
+
+            // false on timeout (unit: milliseconds, of ITPS::Clock) or closed & drained
+            bool acquire(std::string_view& record, unsigned int timeout_ms) {
+                Clock::time_point const timeout = Clock::now() + boost::chrono::milliseconds(timeout_ms);
+                boost::unique_lock<boost::mutex> lock(mu);
+                while(num_records == 0 && !closed) {
+                    if(!cond_not_empty.wait_until(lock, timeout)) break;
+                }
+                if(num_records == 0) return false;
+                record = peek();
+                return true;
+            }
+
+            bool try_acquire(std::string_view& record) {
+                boost::lock_guard<boost::mutex> guard(mu);
+                if(num_records == 0) return false;
+                record = peek();
+                return true;
+            }
+
+            // free the record returned by the last acquire(), the view gets invalid
+            void release() {
+                boost::unique_lock<boost::mutex> lock(mu);
+                if(num_records == 0) return;
+                skip_wrap();
+                uint32_t size;
+                std::memcpy(&size, &buffer[offset(read_pos)], header_bytes);
+                read_pos += record_bytes(size);
+                if(--num_records == 0) {
+                    // start over at the beginning, an empty ring always fits the largest record
+                    read_pos = write_pos = 0;
+                }
+                lock.unlock();
+                cond_not_full.notify_all();
+            }
+
+            /* Once closed, produce() drops records instead of blocking, and producers that are
+             * currently blocked return. Records already queued can still be acquired. */
+            void close() {
+                {
+                    boost::lock_guard<boost::mutex> guard(mu);
+                    closed = true;
+                }
+                cond_not_full.notify_all();
+                cond_not_empty.notify_all();
+            }
+
+            void reopen() {
+                boost::lock_guard<boost::mutex> guard(mu);
+                closed = false;
+            }
+
+            // number of queued records
+            size_t size() {
+                boost::lock_guard<boost::mutex> guard(mu);
+                return num_records;
+            }
+
+            // bytes taken by the queued records, padding & skipped tail ends included
+            size_t bytes_used() {
+                boost::lock_guard<boost::mutex> guard(mu);
+                return write_pos - read_pos;
+            }
+
+            size_t capacity() const {
+                return buffer.size();
+            }
+
+            // number of records too large for the ring
+            unsigned long dropped() {
+                boost::lock_guard<boost::mutex> guard(mu);
+                return num_dropped;
+            }
+
+        private:
+            static constexpr size_t header_bytes = sizeof(uint32_t);
+            static constexpr size_t alignment = 8;
+            static constexpr uint32_t wrap_marker = 0xFFFFFFFF;
+
+            static size_t align(size_t bytes) {
+                return (bytes + alignment - 1) / alignment * alignment;
+            }
+
+            size_t offset(uint64_t pos) const {
+                return pos % buffer.size();
+            }
+
+            // all called with mu held. Positions only grow, used bytes are write_pos - read_pos
+            size_t needed(size_t payload_size) const {
+                size_t bytes = record_bytes(payload_size);
+                size_t to_end = buffer.size() - offset(write_pos);
+                return bytes <= to_end ? bytes : to_end + bytes; // the tail end gets skipped
+            }
+
+            bool fits(size_t payload_size) const {
+                return write_pos - read_pos + needed(payload_size) <= buffer.size();
+            }
+
+            void push(std::string_view payload) {
+                size_t to_end = buffer.size() - offset(write_pos);
+                if(record_bytes(payload.size()) > to_end) {
+                    std::memcpy(&buffer[offset(write_pos)], &wrap_marker, header_bytes);
+                    write_pos += to_end;
+                }
+                uint32_t size = (uint32_t) payload.size();
+                char *record = &buffer[offset(write_pos)];
+                std::memcpy(record, &size, header_bytes);
+                std::memcpy(record + header_bytes, payload.data(), payload.size());
+                write_pos += record_bytes(payload.size());
+                num_records++;
+            }
+
+            void skip_wrap() {
+                uint32_t size;
+                std::memcpy(&size, &buffer[offset(read_pos)], header_bytes);
+                if(size == wrap_marker) {
+                    read_pos += buffer.size() - offset(read_pos);
+                }
+            }
+
+            std::string_view peek() {
+                skip_wrap();
+                const char *record = &buffer[offset(read_pos)];
+                uint32_t size;
+                std::memcpy(&size, record, header_bytes);
+                return {record + header_bytes, size};
+            }
+
+            alignas(ITPS_CACHE_LINE) boost::mutex mu;
+            std::vector<char> buffer;
+            uint64_t write_pos = 0, read_pos = 0;
+            size_t num_records = 0;
+            bool closed = false;
+            unsigned long num_dropped = 0;
+
+            ClockCondition cond_not_full;
+            ClockCondition cond_not_empty;
+    };
+
+}
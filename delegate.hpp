@@ -0,0 +1,167 @@
+/*
+ * Small-buffer callable wrapper for ITPS callbacks & filters, never allocates when invoked
+ */
+
+
+#pragma once
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+
+/* Bytes a Delegate stores inline, enough for a boost::function / std::function or a lambda
+ * capturing a few pointers */
+#ifndef ITPS_DELEGATE_CAPACITY
+#define ITPS_DELEGATE_CAPACITY (6 * sizeof(void*))
+#endif
+
+/* Define ITPS_DELEGATE_INLINE_ONLY to make a callable that doesn't fit inline a compile error
+ * instead of a heap allocation */
+
+
+namespace ITPS {
+
+    template<class Signature>
+    class Delegate;
+
+    /*
+     * Like boost::function, but a callable of up to ITPS_DELEGATE_CAPACITY bytes is stored
+     * inside the Delegate (check fits<F>()). A bigger (or over-aligned) one is moved to the
+     * heap, allocated when the Delegate is constructed or copied, never when it's invoked;
+     * with ITPS_DELEGATE_INLINE_ONLY it's a compile error instead. This is the one policy for
+     * every callable ITPS takes (subscriber filters, callbacks).
+     * Invoking it is one call through a function pointer to a thunk in which the callable's
+     * type is known, so its body is inlined there.
+     *
+     * Delegate::bind<&Observer::method>(observer) stores nothing but the object pointer, the
+     * member function is a template argument, so the thunk calls it directly (and the
+     * compiler devirtualizes a virtual one when the Observer type is final).
+     */
+    template<class R, class... Args>
+    class Delegate<R(Args...)> {
+        public:
+            Delegate() {}
+
+            template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Delegate>::value>::type>
+            Delegate(F func) {
+                typedef typename std::decay<F>::type func_t;
+                if constexpr(fits<func_t>()) {
+                    new (&storage) func_t(std::move(func));
+                    invoke = &invoke_callable<func_t>;
+                    manage = &manage_callable<func_t>;
+                }
+                else {
+#ifdef ITPS_DELEGATE_INLINE_ONLY
+                    static_assert(fits<func_t>(), "the callable doesn't fit in a Delegate, raise ITPS_DELEGATE_CAPACITY or capture less");
+#endif
+                    new (&storage) func_t*(new func_t(std::move(func)));
+                    invoke = &invoke_boxed<func_t>;
+                    manage = &manage_boxed<func_t>;
+                }
+            }
+
+            template<auto Method, class Object>
+            static Delegate bind(Object *object) {
+                Delegate delegate;
+                new (&delegate.storage) Object*(object);
+                delegate.invoke = &invoke_method<Object, Method>;
+                return delegate;
+            }
+
+            Delegate(const Delegate& other) {
+                copy_from(other);
+            }
+
+            Delegate& operator=(const Delegate& other) {
+                if(this != &other) {
+                    reset();
+                    copy_from(other);
+                }
+                return *this;
+            }
+
+            ~Delegate() {
+                reset();
+            }
+
+            // stored inline without allocating, otherwise on the heap
+            template<class F>
+            static constexpr bool fits() {
+                return sizeof(F) <= ITPS_DELEGATE_CAPACITY && alignof(F) <= alignof(storage_t);
+            }
+
+            R operator()(Args... args) const {
+                return invoke(&storage, std::forward<Args>(args)...);
+            }
+
+            explicit operator bool() const {
+                return invoke != nullptr;
+            }
+
+        private:
+            typedef typename std::aligned_storage<ITPS_DELEGATE_CAPACITY, alignof(std::max_align_t)>::type storage_t;
+            enum class op_t { Copy, Destroy };
+
+            template<class F>
+            static R invoke_callable(const void *storage, Args... args) {
+                // the callable may be mutable, the storage only is const for operator() const
+                return (*static_cast<F*>(const_cast<void*>(storage)))(std::forward<Args>(args)...);
+            }
+
+            // a callable too big for the storage, which holds a pointer to it
+            template<class F>
+            static R invoke_boxed(const void *storage, Args... args) {
+                return (**static_cast<F* const*>(storage))(std::forward<Args>(args)...);
+            }
+
+            template<class Object, auto Method>
+            static R invoke_method(const void *storage, Args... args) {
+                return ((*static_cast<Object* const*>(storage))->*Method)(std::forward<Args>(args)...);
+            }
+
+            template<class F>
+            static void manage_callable(op_t op, void *dst, const void *src) {
+                if(op == op_t::Copy) {
+                    new (dst) F(*static_cast<const F*>(src));
+                }
+                else {
+                    static_cast<F*>(dst)->~F();
+                }
+            }
+
+            template<class F>
+            static void manage_boxed(op_t op, void *dst, const void *src) {
+                if(op == op_t::Copy) {
+                    new (dst) F*(new F(**static_cast<F* const*>(src)));
+                }
+                else {
+                    delete *static_cast<F**>(dst);
+                }
+            }
+
+            void copy_from(const Delegate& other) {
+                invoke = other.invoke;
+                manage = other.manage;
+                if(manage) {
+                    manage(op_t::Copy, &storage, &other.storage);
+                }
+                else {
+                    storage = other.storage; // a bound object pointer, or nothing
+                }
+            }
+
+            void reset() {
+                if(manage) {
+                    manage(op_t::Destroy, &storage, nullptr);
+                }
+                invoke = nullptr;
+                manage = nullptr;
+            }
+
+            storage_t storage;
+            R (*invoke)(const void*, Args...) = nullptr;
+            void (*manage)(op_t, void*, const void*) = nullptr; // nullptr for bound methods
+    };
+
+}
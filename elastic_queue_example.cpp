@@ -0,0 +1,41 @@
+#include <iostream>
+#include "inter_thread_pubsub.hpp"
+
+using namespace ITPS;
+using namespace std;
+
+int main(int, char *[]) {
+    Publisher<int> samples("sensors", "raw");
+    size_t used0 = QueueBudget::used();
+
+    // starts with 16 slots, grows by 16 up to 1024 slots
+    Subscriber<int> logger("sensors", "raw", 16, 1024);
+    logger.set_overflow_policy(OverflowPolicy::DropNewest); // once it can't grow anymore
+    logger.subscribe();
+    size_t slot_bytes = (QueueBudget::used() - used0) / 16;
+    auto num_slots = [&]() { return (QueueBudget::used() - used0) / slot_bytes; };
+
+    // every queue of the process may use 128 slots' worth of memory, this one included
+    QueueBudget::set_limit(QueueBudget::used() + 112 * slot_bytes);
+
+    // a burst while the logger is busy: the queue grows up to the budget, then drops
+    for(int i = 0; i < 300; i++) {
+        samples.publish(i);
+    }
+    size_t burst_slots = num_slots();
+
+    // samples are never negative, -1 means the queue is drained
+    int num_queued = 0;
+    while(logger.pop_msg(0, -1) >= 0) num_queued++;
+    cout << "burst: " << burst_slots << " slots (expected 128), dropped " << 300 - num_queued << " (expected 172)" << endl;
+
+    // back to a steady flow, the queue shrinks a chunk at a time down to its initial size
+    for(int i = 0; i < 2000; i++) {
+        samples.publish(i);
+        logger.pop_msg(0, -1);
+    }
+    cout << "steady: " << num_slots() << " slots (expected 16)" << endl;
+
+    QueueBudget::set_limit(0);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <iostream>
+#include "inter_thread_pubsub.hpp"
+
+using namespace ITPS;
+using namespace std;
+
+struct Reading {
+    int sensor_id;
+    double value;
+};
+
+// functor filter, its operator() gets inlined into the publisher's check
+struct FromSensor {
+    int sensor_id;
+    bool operator()(const Reading& reading) const {
+        return reading.sensor_id == sensor_id;
+    }
+};
+
+bool is_alarm(const Reading& reading) {
+    return reading.value > 90.0;
+}
+
+int main(int, char *[]) {
+    Publisher<Reading> readings("plant", "temperature");
+
+    // evaluated by the publisher: rejected msgs are never copied into these queues
+    Subscriber<Reading> sensor2("plant", "temperature", 100);
+    sensor2.subscribe(FromSensor{2});
+
+    Subscriber<Reading> alarms("plant", "temperature", 100);
+    alarms.set_filter(&is_alarm);
+    alarms.subscribe();
+
+    int num_cold = 0;
+    Subscriber<Reading> cold("plant", "temperature");
+    cold.set_filter([](const Reading& reading) { return reading.value < 10.0; });
+    cold.subscribe();
+    cold.add_on_published_callback([&num_cold](const Reading&) { num_cold++; });
+
+    // 4 sensors, values 0 to 99
+    for(int i = 0; i < 100; i++) {
+        readings.publish({i % 4, double(i)});
+    }
+
+    // a timed pop with no wait returns the sentinel once the queue is drained
+    const Reading none = {-1, 0.0};
+    int num_sensor2 = 0, num_alarms = 0;
+    while(sensor2.pop_msg(0, none).sensor_id != none.sensor_id) num_sensor2++;
+    while(alarms.pop_msg(0, none).sensor_id != none.sensor_id) num_alarms++;
+
+    cout << "sensor 2: " << num_sensor2 << " (expected 25)" << endl;
+    cout << "alarms: " << num_alarms << " (expected 9)" << endl;
+    cout << "cold: " << num_cold << " (expected 10)" << endl;
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <iostream>
+#include "inter_thread_pubsub.hpp"
+
+using namespace ITPS;
+using namespace std;
+
+// pop everything that's queued, -1 means the queue is drained
+void print_queue(const char *name, Subscriber<int>& sub, const char *expected) {
+    int msg;
+    cout << name << ":";
+    while((msg = sub.pop_msg(0, -1)) >= 0) {
+        cout << " " << msg;
+    }
+    cout << " (expected" << expected << ")" << endl;
+}
+
+int main(int, char *[]) {
+    {
+        // the channel keeps the last 5 msgs for subscribers joining late
+        Publisher<int> config("robot", "config", 5);
+        for(int i = 0; i < 10; i++) {
+            config.publish(i);
+        }
+
+        // seeded with the whole history, oldest first
+        Subscriber<int> late("robot", "config", 10);
+        late.subscribe();
+        print_queue("late subscriber", late, " 5 6 7 8 9");
+
+        // a smaller queue gets the newest msgs that fit
+        Subscriber<int> small("robot", "config", 3);
+        small.subscribe();
+        print_queue("queue of 3", small, " 7 8 9");
+
+        // the filter applies to the history too
+        Subscriber<int> even("robot", "config", 10);
+        even.set_filter([](const int& msg) { return msg % 2 == 0; });
+        even.subscribe();
+        print_queue("even only", even, " 6 8");
+    }
+
+    // the channel and its history outlive the publisher
+    Subscriber<int> after("robot", "config", 10);
+    after.subscribe();
+    print_queue("after the publisher is gone", after, " 5 6 7 8 9");
+    return 0;
+}
@@ -47,19 +47,30 @@ void thread1_msg2_callback(std::ofstream* file, double msg) {
 }
 
 
-void thread2_msg1_callback(std::ofstream* file, std::string msg) {
-    std::stringstream ss;
-    ss << "<==============================>" << std::endl;
-    ss << "pub1: " << msg << std::endl;   
-    *file << ss.str();
-}
+// statically typed observer: the publisher calls its member functions directly, msgs by reference
+class Thread2Logger {
+    public:
+        Thread2Logger(std::ofstream* file) {
+            this->file = file;
+        }
 
-void thread2_msg2_callback(std::ofstream* file, double msg) {
-    std::stringstream ss;
-    ss << "<==============================>" << std::endl;
-    ss << "pub2: " << msg << std::endl;      
-    *file << ss.str();
-}
+        void on_msg1(const std::string& msg) {
+            std::stringstream ss;
+            ss << "<==============================>" << std::endl;
+            ss << "pub1: " << msg << std::endl;   
+            *file << ss.str();
+        }
+
+        void on_msg2(const double& msg) {
+            std::stringstream ss;
+            ss << "<==============================>" << std::endl;
+            ss << "pub2: " << msg << std::endl;      
+            *file << ss.str();
+        }
+
+    private:
+        std::ofstream *file;
+};
 
 
 int main(int argc, char *argv[]) {
@@ -107,8 +118,9 @@ int main(int argc, char *argv[]) {
         file.open("observer_example.thread2.txt");
 
 
-        sub1.add_on_published_callback(boost::bind(&thread2_msg1_callback, &file,  _1));
-        sub2.add_on_published_callback(boost::bind(&thread2_msg2_callback, &file,  _1));
+        Thread2Logger logger(&file);
+        sub1.add_observer<&Thread2Logger::on_msg1>(logger);
+        sub2.add_observer<&Thread2Logger::on_msg2>(logger);
 
         delay(1000); // wait for 1 second
     });
@@ -0,0 +1,52 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include "pipeline.hpp"
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+
+using namespace ITPS;
+using namespace std;
+
+int main(int, char *[]) {
+    std::atomic<long> sum_squares{0}, num_logged{0};
+
+    Pipeline pipeline;
+
+    // source -> square -> offset are single-consumer hops: fused into direct calls on the source thread
+    int i = 0;
+    pipeline.source<int>("counter", "count", [&i](int& msg) {
+        if(i > 1000) return false; // ends the source
+        msg = i++;
+        return true;
+    });
+    pipeline.stage<int, long>("square", "count", "squared", [](const int& msg) { return (long)msg * msg; });
+    pipeline.stage<long, long>("offset", "squared", "offset", [](const long& msg) { return msg + 1; });
+
+    // "offset" fans out to 2 consumers: queues get inserted
+    pipeline.sink<long>("accumulate", "offset", [&sum_squares](const long& msg) { sum_squares += msg; });
+    pipeline.stage<long, std::string>("format", "offset", "text", [](const long& msg) { return std::to_string(msg); })
+            .parallel(2, 50);
+
+    // slow consumer, decoupled so that it doesn't hold back "format"
+    pipeline.sink<std::string>("log", "text", [&num_logged](const std::string&) { num_logged++; }).queued(1000);
+
+    // external input, published outside the pipeline
+    pipeline.sink<double>("sensor", "sensorA data", [](const double&) {});
+
+    std::ofstream file("pipeline_example.dot.txt");
+    file << pipeline.to_dot();
+
+    pipeline.start();
+    Publisher<double> sensor("sensorA data");
+    for(int k = 0; k < 10; k++) {
+        sensor.publish(k);
+    }
+
+    pipeline.wait(); // the counter source ends after 1001 msgs, every one of them gets through
+
+    // sum of (k^2 + 1) for k in [0, 1000]
+    cout << "sum: " << sum_squares << " (expected " << 1000L * 1001 * 2001 / 6 + 1001 << ")" << endl;
+    cout << "logged: " << num_logged << " (expected 1001)" << endl;
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <vector>
+#include "inter_thread_pubsub.hpp"
+
+using namespace ITPS;
+using namespace std;
+
+typedef std::vector<double> frame_t;
+
+void print_stats(const char *when, PoolStats stats) {
+    cout << when << ": capacity " << stats.capacity << ", reserved " << stats.reserved
+         << ", in use " << stats.in_use << ", exhausted " << stats.exhausted << endl;
+}
+
+int main(int, char *[]) {
+    Publisher<Pooled<frame_t>> camera("camera", "frame");
+    Subscriber<Pooled<frame_t>> display("camera", "frame", 8);
+    Subscriber<Pooled<frame_t>> recorder("camera", "frame", 8);
+    display.subscribe();
+    recorder.subscribe();
+    print_stats("subscribed", camera.pool_stats()); // 2 for the publisher + 8 per queue
+
+    // fan-out: both subscribers get a handle to the same slot, the frame is never copied
+    for(int i = 0; i < 100; i++) {
+        Pooled<frame_t> frame = camera.loan();
+        frame->assign(1000, i);
+        camera.publish(frame);
+
+        Pooled<frame_t> shown = display.pop_msg();
+        Pooled<frame_t> recorded = recorder.pop_msg();
+        if(shown.get() != recorded.get() || (*shown)[0] != i) {
+            cout << "frame " << i << " got copied!" << endl;
+        }
+    }
+    // the 100 frames went through the same few slots, only the latest one is still held by the channel
+    print_stats("after 100 frames", camera.pool_stats());
+
+    // subscribers coming & going reuse the slots reserved by the ones that left
+    for(int i = 0; i < 100; i++) {
+        Subscriber<Pooled<frame_t>> viewer("camera", "frame", 8);
+        viewer.subscribe();
+    }
+    print_stats("after 100 viewers", camera.pool_stats());
+
+    return 0;
+}
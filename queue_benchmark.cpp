@@ -0,0 +1,162 @@
+#include <iostream>
+#include <queue>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include "cp_queue.hpp"
+#include "byte_ring.hpp"
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+/* Compares ConsumerProducerQueue (preallocated ring) with the previous std::queue based one:
+ *   1. heap allocations made while messages flow through the queue
+ *   2. producer / consumer throughput
+ *   3. std::string msgs: a ring of std::string slots vs records inline in an ITPS::ByteRing
+ */
+
+//----- allocation counter -----//
+static std::atomic<unsigned long> num_allocs{0};
+
+void* operator new(std::size_t size) {
+    num_allocs++;
+    void *p = std::malloc(size ? size : 1);
+    if(p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+//------------------------------//
+
+
+// the former ConsumerProducerQueue: std::queue storage, every field packed together
+template <typename data_t>
+class LegacyQueue {
+    public:
+        LegacyQueue(unsigned int max_size) : max_size(max_size) {}
+
+        void produce(data_t data) {
+            mu.lock();
+            while(cp_queue.size() >= max_size) {
+                cond_not_full.wait(mu);
+            }
+            cp_queue.push(data);
+            mu.unlock();
+            cond_not_empty.notify_all();
+        }
+
+        data_t consume() {
+            mu.lock();
+            while(cp_queue.empty()) {
+                cond_not_empty.wait(mu);
+            }
+            data_t rtn = cp_queue.front();
+            cp_queue.pop();
+            mu.unlock();
+            cond_not_full.notify_all();
+            return rtn;
+        }
+
+    private:
+        boost::mutex mu;
+        boost::condition_variable_any cond_not_full, cond_not_empty;
+        std::queue<data_t> cp_queue;
+        unsigned int max_size;
+};
+
+
+template <class Queue>
+void bench_queue(const char *name, unsigned int queue_size, int num_msgs) {
+    Queue queue(queue_size);
+    unsigned long allocs0 = num_allocs;
+    auto t0 = boost::chrono::steady_clock::now();
+
+    boost::thread consumer([&]() {
+        long sum = 0;
+        for(int i = 0; i < num_msgs; i++) {
+            sum += queue.consume();
+        }
+        if(sum != (long)num_msgs * (num_msgs - 1) / 2) {
+            cout << "  wrong sum!" << endl;
+        }
+    });
+    for(int i = 0; i < num_msgs; i++) {
+        queue.produce(i);
+    }
+    consumer.join();
+
+    auto t1 = boost::chrono::steady_clock::now();
+    double ms = boost::chrono::duration<double, boost::milli>(t1 - t0).count();
+    // thread creation itself allocates a few times, same for both queues
+    cout << "  " << name << ": " << num_msgs / ms * 1000.0 << " msgs/s, "
+         << num_allocs - allocs0 << " heap allocations" << endl;
+}
+
+
+// msgs longer than the small string optimization, every copy into a std::string slot allocates
+void bench_strings(unsigned int queue_size, int num_msgs) {
+    std::string msg(100, 'x');
+    {
+        ConsumerProducerQueue<std::string> queue(queue_size);
+        unsigned long allocs0 = num_allocs;
+        auto t0 = boost::chrono::steady_clock::now();
+        boost::thread consumer([&]() {
+            size_t bytes = 0;
+            for(int i = 0; i < num_msgs; i++) {
+                bytes += queue.consume().size();
+            }
+        });
+        for(int i = 0; i < num_msgs; i++) {
+            queue.produce(msg);
+        }
+        consumer.join();
+        double ms = boost::chrono::duration<double, boost::milli>(boost::chrono::steady_clock::now() - t0).count();
+        cout << "  string slots: " << num_msgs / ms * 1000.0 << " msgs/s, "
+             << num_allocs - allocs0 << " heap allocations" << endl;
+    }
+    {
+        ITPS::ByteRing ring(queue_size * ITPS::ByteRing::record_bytes(msg.size()));
+        unsigned long allocs0 = num_allocs;
+        auto t0 = boost::chrono::steady_clock::now();
+        boost::thread consumer([&]() {
+            size_t bytes = 0;
+            std::string_view record;
+            for(int i = 0; i < num_msgs; i++) {
+                ring.acquire(record);
+                bytes += record.size();
+                ring.release();
+            }
+        });
+        for(int i = 0; i < num_msgs; i++) {
+            ring.produce(msg);
+        }
+        consumer.join();
+        double ms = boost::chrono::duration<double, boost::milli>(boost::chrono::steady_clock::now() - t0).count();
+        cout << "  byte ring   : " << num_msgs / ms * 1000.0 << " msgs/s, "
+             << num_allocs - allocs0 << " heap allocations" << endl;
+    }
+}
+
+
+int main(int, char *[]) {
+    const int num_msgs = 200000;
+
+    // a large queue makes std::deque grow & shrink its chunks as the fill level changes
+    for(unsigned int queue_size: {16u, 4096u}) {
+        cout << "queue size " << queue_size << ", " << num_msgs << " msgs" << endl;
+        bench_queue<LegacyQueue<int>>("std::queue", queue_size, num_msgs);
+        bench_queue<ConsumerProducerQueue<int>>("ring      ", queue_size, num_msgs);
+    }
+
+    cout << "100-byte string msgs, queue of 1024, " << num_msgs << " msgs" << endl;
+    bench_strings(1024, num_msgs);
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <iostream>
+#include "inter_thread_pubsub.hpp"
+
+using namespace ITPS;
+using namespace std;
+
+// drain the queue with non-blocking pops, msgs are never negative here
+int count_msgs(Subscriber<double>& sub) {
+    int num_msgs = 0;
+    while(sub.pop_msg(0, -1.0) >= 0) num_msgs++;
+    return num_msgs;
+}
+
+int main(int, char *[]) {
+    // simulated time, stepped by hand: the counts don't depend on the machine
+    VirtualClock clock;
+    Clock::install(&clock);
+
+    Publisher<double> imu("robot", "imu");
+
+    // a 10 Hz view of the 1 kHz topic, the publisher only copies the admitted msgs
+    Subscriber<double> display("robot", "imu", 100);
+    display.set_max_rate(10);
+    display.subscribe();
+
+    Subscriber<double> logger("robot", "imu", 100);
+    logger.set_min_interval(250);
+    logger.subscribe();
+
+    Subscriber<double> decimated("robot", "imu", 1000);
+    decimated.set_decimation(10);
+    decimated.subscribe();
+
+    // 1 s worth of msgs at 1 kHz
+    for(int i = 0; i < 1000; i++) {
+        imu.publish(i);
+        clock.advance(boost::chrono::milliseconds(1));
+    }
+
+    cout << "10 Hz: " << count_msgs(display) << " (expected 10)" << endl;
+    cout << "every 250 ms: " << count_msgs(logger) << " (expected 4)" << endl;
+    cout << "every 10th: " << count_msgs(decimated) << " (expected 100)" << endl;
+
+    Clock::install(nullptr);
+    return 0;
+}
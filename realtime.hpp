@@ -0,0 +1,151 @@
+/*
+ * Real-time configuration for ITPS: locked & pre-faulted memory, allocation checks on the hot path
+ */
+
+
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <alloca.h>
+
+
+namespace ITPS {
+
+    /*
+     * Publish & consume already work on storage allocated up front: subscriber queues are
+     * preallocated rings, channels and their history rings are built when publishers /
+     * subscribers are constructed, publish() resolves nothing by string. What's left for a
+     * hard-latency loop is to keep that storage resident and to catch whatever still allocates:
+     *
+     *  * RealTime::configure() at startup, before the RT threads start: mlockall() current and
+     *    future pages, stop malloc from trimming / mmapping (freed memory stays in the locked
+     *    heap), and pre-fault a heap reserve (optionally backed by transparent huge pages).
+     *  * RealTime::prefault_stack() at the start of each RT thread.
+     *  * Publisher / Subscriber ::set_realtime() marks the channel as an RT topic: every publish
+     *    and pop on it runs inside a RealTime::HotPath scope.
+     *  * Link realtime_alloc_hook.cpp into the RT executable (check realtime_example in the
+     *    makefile): it replaces the global operator new / delete, and an allocation inside a
+     *    HotPath scope calls the alloc handler, which aborts by default.
+     *
+     * The things that still allocate on an RT topic, and that the hook catches: msg types owning
+     * heap memory (std::string...), elastic queues growing and the Expand overflow policy, the
+     * first traced event of a thread (ITPS::Tracer), and observer callbacks that allocate.
+     */
+    class RealTime {
+        public:
+            struct Config {
+                bool lock_memory = true;
+                size_t heap_reserve_bytes = 64 << 20; // pre-faulted, then handed back to malloc
+                size_t stack_prefault_bytes = 256 << 10; // of the calling thread
+                bool huge_pages = false; // madvise(MADV_HUGEPAGE) the heap reserve
+            };
+
+            /* return false if the memory couldn't be locked (RLIMIT_MEMLOCK / CAP_IPC_LOCK),
+             * the rest of the configuration still applies */
+            static bool configure() {
+                return configure(Config());
+            }
+
+            static bool configure(const Config& config) {
+                bool locked = true;
+                if(config.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+                    locked = false;
+                }
+                // keep freed memory in the (locked) heap instead of giving it back to the OS
+                mallopt(M_TRIM_THRESHOLD, -1);
+                mallopt(M_MMAP_MAX, 0);
+
+                if(config.heap_reserve_bytes > 0) {
+                    char *reserve = (char*) malloc(config.heap_reserve_bytes);
+                    if(reserve != nullptr) {
+                        if(config.huge_pages) {
+                            advise_huge_pages(reserve, config.heap_reserve_bytes);
+                        }
+                        touch(reserve, config.heap_reserve_bytes);
+                        free(reserve);
+                    }
+                }
+                prefault_stack(config.stack_prefault_bytes);
+                return locked;
+            }
+
+            // fault in bytes of the calling thread's stack (must be smaller than the stack)
+            static void prefault_stack(size_t bytes) {
+                if(bytes == 0) return;
+                touch((char*) alloca(bytes), bytes);
+            }
+
+            /* Marks the calling thread as being on the publish / consume path of an RT topic */
+            class HotPath {
+                public:
+                    HotPath(bool active = true) : active(active) {
+                        if(active) depth()++;
+                    }
+                    ~HotPath() {
+                        if(active) depth()--;
+                    }
+                    HotPath(const HotPath&) = delete;
+                    HotPath& operator=(const HotPath&) = delete;
+                private:
+                    bool active;
+            };
+
+            static bool in_hot_path() {
+                return depth() > 0;
+            }
+
+            typedef void (*alloc_handler_t)(size_t bytes);
+
+            // called on an allocation inside a HotPath scope (with realtime_alloc_hook.cpp linked in)
+            static void set_alloc_handler(alloc_handler_t handler) {
+                alloc_handler() = handler;
+            }
+
+            static void on_alloc(size_t bytes) {
+                if(!in_hot_path()) return;
+                int saved = depth();
+                depth() = 0; // the handler itself may allocate
+                alloc_handler().load()(bytes);
+                depth() = saved;
+            }
+
+        private:
+            static int& depth() {
+                static thread_local int depth = 0;
+                return depth;
+            }
+
+            static std::atomic<alloc_handler_t>& alloc_handler() {
+                static std::atomic<alloc_handler_t> handler{[](size_t bytes) {
+                    // no iostream, it may allocate
+                    fprintf(stderr, "[ITPS realtime] allocation of %zu bytes on the hot path of an RT topic\n", bytes);
+                    abort();
+                }};
+                return handler;
+            }
+
+            static void touch(char *memory, size_t bytes) {
+                size_t page = sysconf(_SC_PAGESIZE);
+                for(size_t i = 0; i < bytes; i += page) {
+                    ((volatile char*) memory)[i] = 0;
+                }
+            }
+
+            static void advise_huge_pages(char *memory, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+                const size_t huge_page = 2 << 20;
+                size_t begin = ((size_t) memory + huge_page - 1) & ~(huge_page - 1);
+                size_t end = ((size_t) memory + bytes) & ~(huge_page - 1);
+                if(end > begin) {
+                    madvise((void*) begin, end - begin, MADV_HUGEPAGE);
+                }
+#endif
+            }
+    };
+
+}
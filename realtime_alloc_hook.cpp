@@ -0,0 +1,127 @@
+/*
+ * Replacement of the global operator new / delete for ITPS real-time binaries (check realtime.hpp)
+ *
+ * Link this file into the RT executable only, and only once: every allocation inside a
+ * RealTime::HotPath scope then goes to the RealTime alloc handler, which aborts by default.
+ * All the replaceable forms are covered (plain, array, nothrow, aligned and sized), so that
+ * no allocation on the hot path gets past the hook.
+ */
+
+
+#include <cstdlib>
+#include <new>
+#include "realtime.hpp"
+
+
+namespace {
+
+    void* allocate(std::size_t size) {
+        ITPS::RealTime::on_alloc(size);
+        return std::malloc(size ? size : 1);
+    }
+
+    void* allocate(std::size_t size, std::align_val_t align) {
+        ITPS::RealTime::on_alloc(size);
+        std::size_t alignment = static_cast<std::size_t>(align);
+        if(alignment < sizeof(void*)) alignment = sizeof(void*);
+        void *p = nullptr;
+        if(posix_memalign(&p, alignment, size ? size : 1) != 0) return nullptr;
+        return p;
+    }
+
+    void* allocate_or_throw(std::size_t size) {
+        void *p = allocate(size);
+        if(p == nullptr) throw std::bad_alloc();
+        return p;
+    }
+
+    void* allocate_or_throw(std::size_t size, std::align_val_t align) {
+        void *p = allocate(size, align);
+        if(p == nullptr) throw std::bad_alloc();
+        return p;
+    }
+
+}
+
+
+void* operator new(std::size_t size) {
+    return allocate_or_throw(size);
+}
+
+void* operator new[](std::size_t size) {
+    return allocate_or_throw(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    return allocate_or_throw(size, align);
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return allocate_or_throw(size, align);
+}
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return allocate(size, align);
+}
+
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return allocate(size, align);
+}
+
+
+// malloc & posix_memalign memory are both given back with free
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
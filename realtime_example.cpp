@@ -0,0 +1,58 @@
+#include <iostream>
+#include "inter_thread_pubsub.hpp" // linked with realtime_alloc_hook.cpp, check the makefile
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+
+using namespace ITPS;
+using namespace std;
+
+//----- helper systime functions -----//
+void delay(unsigned int milliseconds) {
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(milliseconds));
+}
+//------------------------------------//
+
+static std::atomic<unsigned long> num_rt_allocs{0};
+
+
+int main(int, char *[]) {
+    if(!RealTime::configure()) {
+        cout << "mlockall failed (RLIMIT_MEMLOCK?), running with unlocked memory" << endl;
+    }
+
+    // count instead of aborting, to show what the hook catches
+    RealTime::set_alloc_handler([](size_t) { num_rt_allocs++; });
+
+    // everything allocates here, at startup
+    Publisher<double> pub("control", "setpoint");
+    pub.set_realtime();
+    Subscriber<double> sub("control", "setpoint", 1000);
+    sub.subscribe();
+
+    Publisher<std::string> text_pub("control", "log");
+    text_pub.set_realtime();
+    Subscriber<std::string> text_sub("control", "log", 10);
+    text_sub.subscribe();
+
+    boost::thread consumer([&sub]() {
+        RealTime::prefault_stack(64 << 10);
+        double sum = 0;
+        for(int i = 0; i < 100000; i++) {
+            sum += sub.pop_msg();
+        }
+        cout << "sum: " << sum << " (expected " << 99999.0 * 100000 / 2 << ")" << endl;
+    });
+
+    for(int i = 0; i < 100000; i++) {
+        pub.publish(i);
+    }
+    consumer.join();
+    cout << "allocations on the RT double topic: " << num_rt_allocs << endl;
+
+    // a msg owning heap memory is copied into the queue: caught by the hook
+    std::string text = "a text too long for the small string optimization";
+    text_pub.publish(text);
+    text_sub.pop_msg();
+    cout << "allocations on the RT string topic: " << num_rt_allocs << endl;
+    return 0;
+}
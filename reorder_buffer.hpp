@@ -0,0 +1,109 @@
+/*
+ * Sequence-number reorder stage, restores publish order after a consumer group
+ */
+
+
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "virtual_clock.hpp"
+
+
+namespace ITPS {
+
+    typedef unsigned long long sequence_t;
+
+    /* msg of a consumer group queue, seq numbers the msgs of the group in publish order */
+    template<class Msg>
+    struct Sequenced {
+        sequence_t seq;
+        Msg msg;
+    };
+
+    /*
+     * Workers of a consumer group finish their msgs out of order. Each of them hands its
+     * result (or a skip() if a msg produced no result) to the Reorderer with the msg's seq,
+     * and the Reorderer calls emit() with the results in seq order, from the thread that
+     * completed the next expected seq.
+     *
+     * Results are parked in a preallocated window of window_size slots. A worker running
+     * window_size or more seqs ahead of the oldest missing one waits, which bounds the memory
+     * and lets the slow msg catch up. Every seq from first_seq on must be pushed or skipped
+     * exactly once, a missing one holds back everything behind it.
+     */
+    template<class T>
+    class Reorderer {
+        public:
+            Reorderer(boost::function<void(const T&)> emit, unsigned int window_size = 1024, sequence_t first_seq = 0)
+                : emit(emit), window(std::max(window_size, 1u)), next(first_seq) {}
+
+            Reorderer(const Reorderer&) = delete;
+            Reorderer& operator=(const Reorderer&) = delete;
+
+            void push(sequence_t seq, const T& result) {
+                put(seq, &result);
+            }
+
+            // seq produced no result (e.g. filtered out by the worker)
+            void skip(sequence_t seq) {
+                put(seq, nullptr);
+            }
+
+            // the oldest seq not emitted yet
+            sequence_t next_seq() {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                return next;
+            }
+
+            // results waiting for an older seq
+            size_t pending() {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                return num_parked;
+            }
+
+        private:
+            struct slot_t {
+                bool present = false;
+                bool skipped = false;
+                T result;
+            };
+
+            void put(sequence_t seq, const T *result) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if(seq < next) return; // already emitted / skipped, a duplicate
+                while(seq >= next + window.size()) {
+                    window_free.wait(lock);
+                }
+
+                slot_t& slot = window[seq % window.size()];
+                slot.present = true;
+                slot.skipped = result == nullptr;
+                if(result) slot.result = *result;
+                num_parked++;
+
+                // in order emission, under the lock so that two threads never emit concurrently
+                bool advanced = false;
+                for(slot_t *head = &window[next % window.size()]; head->present; head = &window[next % window.size()]) {
+                    if(!head->skipped) emit(head->result);
+                    head->present = false;
+                    head->result = T(); // don't keep resources of an emitted result alive
+                    num_parked--;
+                    next++;
+                    advanced = true;
+                }
+                if(advanced) window_free.notify_all();
+            }
+
+            boost::function<void(const T&)> emit;
+            boost::mutex mutex;
+            ClockCondition window_free;
+            std::vector<slot_t> window;
+            sequence_t next;
+            size_t num_parked = 0;
+    };
+
+}
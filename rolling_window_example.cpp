@@ -0,0 +1,44 @@
+#include <iostream>
+#include <array>
+#include "rolling_window.hpp"
+
+using namespace ITPS;
+using namespace std;
+
+int main(int, char *[]) {
+    // simulated time, stepped by hand
+    VirtualClock clock;
+    Clock::install(&clock);
+
+    // x, y, z acceleration: one window per axis
+    typedef std::array<double, 3> accel_t;
+    Publisher<accel_t> imu("imu", "accel");
+    // last 10 samples, at most 50 ms old, the queue holds 100 msgs between updates
+    WindowedSubscriber<accel_t> accel("imu", "accel", 10, 50, 100);
+    accel.subscribe();
+
+    for(int i = 0; i < 20; i++) {
+        imu.publish({double(i), 2.0 * i, 9.81});
+    }
+    accel.update();
+
+    for(size_t axis = 0; axis < accel.elements(); axis++) {
+        WindowStats stats = accel.stats(axis);
+        cout << "axis " << axis << ": mean " << stats.mean << ", min " << stats.min << ", max " << stats.max << endl;
+    }
+    cout << "x window holds 10..19: mean " << accel.stats(0).mean << " (expected 14.5)" << endl;
+    cout << "z variance " << accel.stats(2).variance << " (expected 0)" << endl;
+
+    // the imu stalls, every sample gets older than 50 ms and the windows empty out
+    clock.advance(boost::chrono::milliseconds(60));
+    accel.update();
+    cout << "after the stall: " << accel.stats(0).count << " samples (expected 0)" << endl;
+
+    imu.publish({1.0, 1.0, 1.0});
+    accel.update();
+    cout << "fresh sample: mean " << accel.stats(1).mean << " (expected 1), variance "
+         << accel.stats(1).variance << " (expected 0)" << endl;
+
+    Clock::install(nullptr);
+    return 0;
+}
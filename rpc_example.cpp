@@ -0,0 +1,75 @@
+#include <iostream>
+#include <cmath>
+#include "rpc.hpp"
+#include "PubSubModule/thread_pool.hpp"
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+
+using namespace ITPS;
+using namespace std;
+
+//----- helper systime functions -----//
+void delay(unsigned int milliseconds) {
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(milliseconds));
+}
+//------------------------------------//
+
+
+int main(int, char *[]) {
+    // inline service: the handler runs on the caller's thread
+    Service<double, double> sqrt_service("math", "sqrt", [](const double& x) {
+        if(x < 0) throw std::domain_error("sqrt of a negative number");
+        return std::sqrt(x);
+    });
+
+    Client<double, double> sqrt_client("math", "sqrt");
+    cout << "sqrt(2) = " << sqrt_client.call(2.0).get() << endl;
+    try {
+        sqrt_client.call(-1.0).get();
+    }
+    catch(const std::domain_error& e) {
+        cout << "the handler's exception reaches the caller: " << e.what() << endl;
+    }
+
+    // pooled service: calls of several clients are served concurrently
+    ThreadPool thread_pool(4);
+    Service<int, int> slow_service("math", "slow square", [](const int& x) {
+        delay(20);
+        return x * x;
+    }, thread_pool);
+
+    Client<int, int> client("math", "slow square");
+    std::vector<std::future<int>> replies;
+    for(int i = 0; i < 8; i++) {
+        replies.push_back(client.call(i));
+    }
+    int sum = 0;
+    for(auto& reply: replies) {
+        sum += reply.get();
+    }
+    cout << "sum of squares 0..7: " << sum << endl;
+
+    int square;
+    if(!client.call(3, square, 5)) {
+        cout << "timed out after 5 ms, the late reply gets dropped" << endl;
+    }
+    if(client.call(4, square, 1000)) {
+        cout << "4 * 4 = " << square << endl;
+    }
+
+    Client<int, int> nobody("math", "cube");
+    try {
+        nobody.call(3).get();
+    }
+    catch(const RpcError& e) {
+        cout << "no service: " << e.what() << endl;
+    }
+
+    try {
+        Service<double, double> second_sqrt("math", "sqrt", [](const double& x) { return x; });
+    }
+    catch(const RpcError& e) {
+        cout << "one service per key: " << e.what() << endl;
+    }
+    return 0;
+}
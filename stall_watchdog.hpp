@@ -0,0 +1,205 @@
+/*
+ * Opt-in watchdog reporting publishers stuck on full subscriber queues
+ */
+
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "cp_queue.hpp"
+
+
+namespace ITPS {
+
+    typedef unsigned long long subscriber_id_t;
+
+    struct StallReport {
+        std::string channel_key;   // "topic_name.msg_name" of the channel being published
+        subscriber_id_t subscriber; // owner of the full queue, 0 if not owned by a Subscriber
+        unsigned int depth;        // msgs in the queue
+        unsigned int capacity;
+        double blocked_ms;         // how long the publisher has been blocked so far
+    };
+
+    /*
+     * Every subscriber queue attached to a channel is registered here with the channel key
+     * and its subscriber, through weak references, so the registry never keeps a queue alive.
+     * Registration happens on subscribe whether a watchdog runs or not, it costs one push
+     * (expired entries are pruned as the registry grows).
+     */
+    class QueueRegistry {
+        public:
+            // the same for every ConsumerProducerQueue<data_t>
+            typedef ConsumerProducerQueue<int>::stall_state_t stall_state_t;
+
+            struct entry_t {
+                std::string channel_key;
+                subscriber_id_t subscriber;
+                // false once the queue is gone, otherwise sample its stall state
+                boost::function<bool(stall_state_t&)> probe;
+                boost::function<void(OverflowPolicy)> set_policy;
+                unsigned long reported_stall = 0; // stall_id of the last reported stall
+            };
+
+            static QueueRegistry& instance() {
+                static QueueRegistry registry;
+                return registry;
+            }
+
+            template<class data_t>
+            void add(std::string channel_key, subscriber_id_t subscriber, boost::shared_ptr<ConsumerProducerQueue<data_t>> queue) {
+                boost::weak_ptr<ConsumerProducerQueue<data_t>> weak_queue = queue;
+                entry_t entry;
+                entry.channel_key = channel_key;
+                entry.subscriber = subscriber;
+                entry.probe = [weak_queue](stall_state_t& state) {
+                    boost::shared_ptr<ConsumerProducerQueue<data_t>> queue = weak_queue.lock();
+                    if(queue == nullptr) return false;
+                    auto queue_state = queue->stall_state();
+                    state = {queue_state.stalled, queue_state.stall_id, queue_state.size, queue_state.capacity};
+                    return true;
+                };
+                entry.set_policy = [weak_queue](OverflowPolicy policy) {
+                    boost::shared_ptr<ConsumerProducerQueue<data_t>> queue = weak_queue.lock();
+                    if(queue != nullptr) queue->set_overflow_policy(policy);
+                };
+
+                boost::lock_guard<boost::mutex> guard(mutex);
+                if(entries.size() >= prune_at) {
+                    prune();
+                    prune_at = 2 * entries.size() + 16;
+                }
+                entries.push_back(entry);
+            }
+
+            /* call visit(entry, state) on every live queue, dropping the expired ones */
+            template<class Visitor>
+            void scan(Visitor visit) {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                auto alive = entries.begin();
+                for(auto it = entries.begin(); it != entries.end(); ++it) {
+                    stall_state_t state;
+                    if(!it->probe(state)) continue;
+                    visit(*it, state);
+                    if(alive != it) *alive = std::move(*it);
+                    ++alive;
+                }
+                entries.erase(alive, entries.end());
+            }
+
+        private:
+            void prune() {
+                stall_state_t state;
+                entries.erase(std::remove_if(entries.begin(), entries.end(), [&](entry_t& entry) {
+                    return !entry.probe(state);
+                }), entries.end());
+            }
+
+            boost::mutex mutex;
+            std::vector<entry_t> entries;
+            size_t prune_at = 16;
+    };
+
+
+    /*
+     * A publisher whose subscriber queue is full blocks in ConsumerProducerQueue::produce()
+     * until the subscriber pops. The watchdog thread scans the registered queues every
+     * period_ms and reports each publisher blocked for longer than threshold_ms (once per
+     * stall) to the report handler, which prints to std::cerr by default.
+     *
+     * With a fallback policy other than Block, the stalled queue is switched to it for good:
+     * DropNewest / DropOldest make the publisher skip / overwrite msgs of that slow subscriber,
+     * Expand grows the queue. Either way the blocked publisher resumes.
+     */
+    class StallWatchdog {
+        public:
+            StallWatchdog(unsigned int threshold_ms, unsigned int period_ms = 100)
+                : threshold(boost::chrono::milliseconds(threshold_ms)), period_ms(period_ms) {
+                handler = [](const StallReport& report) {
+                    std::cerr << "[ITPS watchdog] publisher of \"" << report.channel_key << "\" blocked for "
+                              << report.blocked_ms << " ms on the queue of subscriber " << report.subscriber
+                              << " (" << report.depth << "/" << report.capacity << ")" << std::endl;
+                };
+            }
+
+            StallWatchdog(const StallWatchdog&) = delete;
+            StallWatchdog& operator=(const StallWatchdog&) = delete;
+
+            ~StallWatchdog() {
+                stop();
+            }
+
+            // must be called before start()
+            void set_report_handler(boost::function<void(const StallReport&)> handler) {
+                this->handler = handler;
+            }
+
+            // must be called before start()
+            void set_fallback_policy(OverflowPolicy policy) {
+                fallback = policy;
+            }
+
+            void start() {
+                if(thread) return;
+                thread = boost::shared_ptr<boost::thread>(new boost::thread([this]() {
+                    try {
+                        while(true) {
+                            boost::this_thread::sleep_for(boost::chrono::milliseconds(period_ms));
+                            check();
+                        }
+                    }
+                    catch(const boost::thread_interrupted&) {}
+                }));
+            }
+
+            void stop() {
+                if(!thread) return;
+                thread->interrupt();
+                thread->join();
+                thread.reset();
+            }
+
+            // one scan, also usable without the thread
+            void check() {
+                std::vector<StallReport> reports;
+                std::vector<boost::function<void(OverflowPolicy)>> to_release;
+                QueueRegistry::instance().scan([&](QueueRegistry::entry_t& entry, const QueueRegistry::stall_state_t& state) {
+                    if(state.stalled < threshold || state.stall_id == entry.reported_stall) {
+                        return;
+                    }
+                    entry.reported_stall = state.stall_id;
+
+                    reports.push_back({entry.channel_key, entry.subscriber, state.size, state.capacity,
+                                       boost::chrono::duration<double, boost::milli>(state.stalled).count()});
+                    if(fallback != OverflowPolicy::Block) {
+                        to_release.push_back(entry.set_policy);
+                    }
+                });
+
+                // outside the registry lock, the handler may subscribe
+                for(auto& report: reports) {
+                    handler(report);
+                }
+                for(auto& set_policy: to_release) {
+                    set_policy(fallback);
+                }
+            }
+
+        private:
+            boost::chrono::steady_clock::duration threshold;
+            unsigned int period_ms;
+            OverflowPolicy fallback = OverflowPolicy::Block;
+            boost::function<void(const StallReport&)> handler;
+            boost::shared_ptr<boost::thread> thread;
+    };
+
+}
@@ -0,0 +1,45 @@
+#include <iostream>
+#include <vector>
+#include "inter_thread_pubsub.hpp"
+#include <boost/thread.hpp>
+
+using namespace ITPS;
+using namespace std;
+
+int main(int, char *[]) {
+    Publisher<int> frames("camera", "frame");
+
+    // a subscriber that never pops: once its queue of 4 is full, the publisher blocks
+    Subscriber<int> stuck("camera", "frame", 4);
+    stuck.subscribe();
+
+    boost::mutex mutex;
+    std::vector<StallReport> reports;
+    StallWatchdog watchdog(50, 10);
+    watchdog.set_report_handler([&](const StallReport& report) {
+        boost::lock_guard<boost::mutex> guard(mutex);
+        reports.push_back(report);
+    });
+    // after the report, the publisher drops the msgs of that subscriber instead of waiting
+    watchdog.set_fallback_policy(OverflowPolicy::DropNewest);
+    watchdog.start();
+
+    boost::thread pub_thread([&frames]() {
+        for(int i = 0; i < 100; i++) {
+            frames.publish(i);
+        }
+    });
+    pub_thread.join(); // only returns because the watchdog released the publisher
+    watchdog.stop();
+
+    for(auto& report: reports) {
+        cout << "report: \"" << report.channel_key << "\" blocked on " << report.depth << "/"
+             << report.capacity << " for " << (report.blocked_ms >= 50 ? ">= 50" : "< 50") << " ms" << endl;
+    }
+    cout << "reports: " << reports.size() << " (expected 1)" << endl;
+    // frames are never negative, -1 means the queue is drained
+    int num_queued = 0;
+    while(stuck.pop_msg(0, -1) >= 0) num_queued++;
+    cout << "queued: " << num_queued << " (expected 4, the other 96 msgs were dropped)" << endl;
+    return 0;
+}
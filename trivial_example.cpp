@@ -29,18 +29,24 @@ unsigned int micros(void) {
 }
 //------------------------------------//
 
+// typed topic: the msg type is part of the declaration, no key string to mistype
+// its channel is "Topic1.Counter", next to the string-named msgs of Topic1
+ITPS_TOPIC_IN("Topic1", Counter, int);
+
 int main(int argc, char *argv[]) {
     
     boost::thread pub_thread( []() {
         
         Publisher<std::string> pub1("Topic1", "Msg1");
         Publisher<double> pub2("Topic1", "Msg2");
+        Publisher<Counter> pub3;
         delay(1);
 
         //while(1) {
             for(int i = 0; i < 100; i++) {
                 pub1.publish("Hello, I'm pub1: " + std::to_string(i));
                 pub2.publish(i + 0.888);    
+                pub3.publish(i);
                 delay(1); // publish one set of data at every 1 ms = 1000 us
             }
         // }
@@ -49,8 +55,10 @@ int main(int argc, char *argv[]) {
     auto sub_lambda = [](std::string file_name) {
         Subscriber<std::string> sub1("Topic1", "Msg1");
         Subscriber<double> sub2("Topic1", "Msg2");
+        Subscriber<Counter> sub3;
         while(!sub1.subscribe());
         while(!sub2.subscribe());
+        sub3.subscribe(); // always succeeds for typed topics
 
         std::ofstream file;
         std::stringstream ss;
@@ -58,10 +66,14 @@ int main(int argc, char *argv[]) {
         int t0 = millis();
         // run this thread for 100 millisecond
         while(millis() - t0 < 100) {
+            // sleep until pub3 publishes again (last of each set) instead of polling, no duplicates
+            Versioned<int> counter = sub3.wait_newer(10); // timeout of 10 milliseconds
+            if(!counter.msg) continue;
+
             ss << "<==============================>" << std::endl;
             ss << "pub1: " << sub1.latest_msg() << std::endl;
             ss << "pub2: " << sub2.latest_msg() << std::endl;      
-            delay_us(10); // microseconds
+            ss << "pub3: " << *counter.msg << " (version " << counter.version << ")" << std::endl;
         }
 
         file << ss.str();
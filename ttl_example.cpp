@@ -0,0 +1,38 @@
+#include <iostream>
+#include "inter_thread_pubsub.hpp"
+
+using namespace ITPS;
+using namespace std;
+
+int main(int, char *[]) {
+    // simulated time, stepped by hand
+    VirtualClock clock;
+    Clock::install(&clock);
+
+    Publisher<int> commands("robot", "velocity");
+    Subscriber<int> controller("robot", "velocity", 100);
+    controller.set_ttl(50); // a velocity command older than 50 ms is stale
+    controller.subscribe();
+
+    // the controller stalls for 100 ms while 10 commands pile up
+    for(int i = 0; i < 10; i++) {
+        commands.publish(i);
+    }
+    clock.advance(boost::chrono::milliseconds(100));
+    for(int i = 10; i < 15; i++) {
+        commands.publish(i);
+    }
+
+    // after the stall it only gets the fresh commands, the backlog expired
+    // commands are never negative, -1 means the queue is drained
+    int msg, first = -1, num_popped = 0;
+    while((msg = controller.pop_msg(0, -1)) >= 0) {
+        if(first < 0) first = msg;
+        num_popped++;
+    }
+    cout << "popped " << num_popped << " (expected 5), first " << first << " (expected 10)" << endl;
+    cout << "expired: " << controller.dropped() << " (expected 10)" << endl;
+
+    Clock::install(nullptr);
+    return 0;
+}
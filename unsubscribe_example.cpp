@@ -0,0 +1,60 @@
+#include <iostream>
+#include <atomic>
+#include "inter_thread_pubsub.hpp"
+#include <boost/thread.hpp>
+
+using namespace ITPS;
+using namespace std;
+
+int main(int, char *[]) {
+    Publisher<int> ticks("clock", "tick");
+    std::atomic<bool> running{true};
+    std::atomic<long> num_published{0};
+
+    // publishes without pause while subscribers come and go
+    boost::thread pub_thread([&]() {
+        int i = 0;
+        while(running) {
+            ticks.publish(i++);
+            num_published++;
+        }
+    });
+
+    int num_late_calls = 0;
+    for(int k = 0; k < 1000; k++) {
+        std::atomic<int> num_calls{0}; // lives on this iteration's stack
+        Subscriber<int> sub("clock", "tick");
+        sub.subscribe();
+        sub.add_on_published_callback([&num_calls](const int&) { num_calls++; });
+
+        // once unsubscribe() returns, the callback is neither running nor called again,
+        // so num_calls may go out of scope right after
+        sub.unsubscribe();
+        int calls = num_calls;
+        boost::this_thread::yield();
+        if(num_calls != calls) num_late_calls++;
+    }
+
+    // a queue subscriber that doesn't pop: the publisher blocks on its full queue
+    Subscriber<int> queued("clock", "tick", 10);
+    queued.subscribe();
+    queued.pop_msg();
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+    long published = num_published;
+
+    // leaving releases the publisher, the msgs already queued can still be popped
+    queued.unsubscribe();
+    while(num_published == published) {
+        boost::this_thread::yield();
+    }
+    // ticks are never negative, -1 means the queue is drained
+    int num_popped = 0;
+    while(queued.pop_msg(0, -1) >= 0) num_popped++;
+
+    running = false;
+    pub_thread.join();
+
+    cout << "callbacks after unsubscribe: " << num_late_calls << " (expected 0)" << endl;
+    cout << "popped after unsubscribe: " << num_popped << " (expected 10)" << endl;
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include <iostream>
+#include <string>
+#include "inter_thread_pubsub.hpp"
+
+using namespace ITPS;
+using namespace std;
+
+// drain the queue with non-blocking pops, msgs are never negative here
+int count_msgs(Subscriber<double>& sub) {
+    int count = 0;
+    while(sub.pop_msg(0, -1.0) >= 0) count++;
+    return count;
+}
+
+int main(int, char *[]) {
+    Publisher<double> left_arm("robot/arm", "left");
+    Publisher<double> right_arm("robot/arm", "right");
+    Publisher<double> leg("robot/leg", "left");
+    Publisher<double> boiler("plant", "temperature");
+    // same key segments as the arms, but a channel of std::string: no double wildcard matches it
+    Publisher<std::string> arm_status("robot/arm", "status");
+
+    // "*" matches one segment: both arms
+    Subscriber<double> arms("robot/arm", "*", 100);
+    arms.subscribe();
+    // "**" matches any number of segments: every double channel under robot
+    Subscriber<double> robot("robot", "**", 100);
+    robot.subscribe();
+
+    // a channel created after the wildcard subscriptions gets attached to them too
+    Publisher<double> head("robot/head", "tilt");
+
+    for(int i = 0; i < 10; i++) {
+        left_arm.publish(i);
+        right_arm.publish(i);
+        leg.publish(i);
+        boiler.publish(i);
+        head.publish(i);
+        arm_status.publish("ok");
+    }
+
+    cout << "robot/arm.*: " << count_msgs(arms) << " (expected 20)" << endl;
+    cout << "robot.**: " << count_msgs(robot) << " (expected 40)" << endl;
+    return 0;
+}